@@ -53,9 +53,20 @@
 // XOR 0x55).  LED data follows, 3 bytes per LED, in order R, G, B,
 // where 0 = off and 255 = max brightness.
 
+// With --compress the host may send run-length encoded frames instead.
+// They start with "Adr" rather than "Ada"; the LED count and checksum
+// are the same, but the data is a series of tokens.  Each token is one
+// byte holding the number of LEDs it covers minus one (1 to 128), with
+// the high bit set for a run: a run token is followed by one R, G, B
+// that is repeated for all its LEDs, a literal token by R, G, B for
+// each of its LEDs.  Runs are shifted out straight from the three
+// color bytes, so decoding needs no more RAM than streaming does.
+
 static const uint8_t magic[] = {'A','d','a'};
 #define MAGICSIZE  sizeof(magic)
 #define HEADERSIZE (MAGICSIZE + 3)
+#define RLE_MAGIC  'r'  // Replaces the last magic byte on encoded frames
+#define RLE_RUN    0x80 // Set on a run token
 
 #define MODE_HEADER 0
 #define MODE_HOLD   1
@@ -79,10 +90,18 @@ void setup()
     indexIn       = 0,
     indexOut      = 0,
     mode          = MODE_HEADER,
-    hi, lo, chk, i, spiFlag;
+    hi, lo, chk, i, spiFlag,
+    encoded       = 0, // Current frame is run-length encoded
+    matched,
+    runBytes      = 0, // Color bytes still to read for a run token
+    runIndex      = 0, // Next byte of runColor to shift out
+    runColor[3];
   int16_t
     bytesBuffered = 0,
     hold          = 0,
+    literalBytes  = 0, // Bytes left in the current literal token
+    runCount      = 0, // LEDs in the current token
+    runOut        = 0, // Bytes of the current run still to shift out
     c;
   int32_t
     bytesRemaining;
@@ -158,9 +177,19 @@ void setup()
 
       // In header-seeking mode.  Is there enough data to check?
       if(bytesBuffered >= HEADERSIZE) {
-        // Indeed.  Check for a 'magic word' match.
-        for(i=0; (i<MAGICSIZE) && (buffer[indexOut++] == magic[i++]););
-        if(i == MAGICSIZE) {
+        // Indeed.  Check for a 'magic word' match, plain or encoded.
+        // A mismatched byte past the first may start the real magic
+        // word, so the search resumes at it rather than after it.
+        for(i=0, matched=1; matched && (i<MAGICSIZE); ) {
+          c       = buffer[indexOut];
+          matched = (c == magic[i]) ||
+                    ((i == MAGICSIZE - 1) && (c == RLE_MAGIC));
+          if(matched || (i == 0)) {
+            indexOut++;
+            i++;
+          }
+        }
+        if(matched) {
           // Magic word matches.  Now how about the checksum?
           hi  = buffer[indexOut++];
           lo  = buffer[indexOut++];
@@ -170,6 +199,10 @@ void setup()
             // (# LEDs is always > 0) and multiply by 3 for R,G,B.
             bytesRemaining = 3L * (256L * (long)hi + (long)lo + 1L);
             bytesBuffered -= 3;
+            encoded        = (c == RLE_MAGIC);
+            literalBytes   = 0;
+            runBytes       = 0;
+            runOut         = 0;
             spiFlag        = 0;         // No data out yet
             mode           = MODE_HOLD; // Proceed to latch wait mode
           } else {
@@ -197,20 +230,57 @@ void setup()
 
       while(spiFlag && !(SPSR & _BV(SPIF))); // Wait for prior byte
       if(bytesRemaining > 0) {
-        if(bytesBuffered > 0) {
-          SPDR = buffer[indexOut++];   // Issue next byte
-          bytesBuffered--;
+        if(runOut > 0) {
+          // Repeating the color of a run; no serial data needed
+          SPDR = runColor[runIndex];   // Issue next byte
+          runIndex = (runIndex == 2) ? 0 : runIndex + 1;
+          runOut--;
           bytesRemaining--;
           spiFlag = 1;
+        } else if(bytesBuffered > 0) {
+          c = buffer[indexOut++];
+          bytesBuffered--;
+          if(!encoded || (literalBytes > 0)) {
+            SPDR = c;                  // Issue next byte
+            bytesRemaining--;
+            spiFlag = 1;
+            if(literalBytes > 0) literalBytes--;
+          } else if(runBytes > 0) {
+            runColor[3 - runBytes--] = c;
+            if(runBytes == 0) {        // Got the color; shift out the run
+              runIndex = 0;
+              runOut   = 3 * runCount;
+            }
+          } else {
+            // A token.  One running past the end of the frame means
+            // the stream is corrupt; resync on the next header.
+            runCount = (c & ~RLE_RUN) + 1;
+            if(3L * runCount > bytesRemaining) {
+              // Latch what was shifted out so far, as at the end of
+              // data, so the next frame doesn't continue the chain.
+              startTime  = micros();
+              hold       = 1000;
+              LED_PORT  |= LED_PIN;
+              mode       = MODE_HEADER;
+              break;
+            }
+            if(c & RLE_RUN) {
+              runBytes = 3;
+            } else {
+              literalBytes = 3 * runCount;
+            }
+          }
         }
         // If serial buffer is threatening to underrun, start
         // introducing progressively longer pauses to allow more
-        // data to arrive (up to a point).
-        if((bytesBuffered < 32) && (bytesRemaining > bytesBuffered)) {
+        // data to arrive (up to a point).  Not while a run is
+        // shifted out, as that doesn't need any.
+        if((runOut == 0) && (bytesBuffered < 32) &&
+           (bytesRemaining > bytesBuffered)) {
           startTime = micros();
           hold      = 100 + (32 - bytesBuffered) * 10;
           mode      = MODE_HOLD;
-	}
+        }
       } else {
         // End of data -- issue latch:
         startTime  = micros();
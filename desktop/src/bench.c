@@ -0,0 +1,988 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Headless benchmarks of the hot paths, built and run by "make bench". Nothing here
+ * needs an X server or a real device: the calculated modes run as they are, the
+ * reducers run on generated framebuffers and frames are written to a pseudo terminal
+ * that a thread empties as fast as it can. Another pseudo terminal is read slowly, like
+ * a device that can't keep up, to check that frames written to it wait for room and
+ * still arrive whole and in order.
+ *
+ * Every benchmark is timed over BENCH_SAMPLES batches of frames so the spread between
+ * batches can be reported next to the mean.
+ *
+ * Where there is more than one way of getting a result, such as the mode kernels or
+ * the number of reduce threads, the results are also compared and the run fails if
+ * they differ.
+ *
+ */
+
+#include "colorswirl.h"
+#include "capture.h"
+#include "config.h"
+#include "effect.h"
+#include "filter.h"
+#include "integral.h"
+#include "latency.h"
+#include "layout.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "reduce.h"
+#include "rle.h"
+#include "serial.h"
+#include "shadow.h"
+
+#include <poll.h>
+
+#define BENCH_SAMPLES    15
+#define BENCH_FRAME_TIME (1.0 / 60) // Elapsed time handed to the calculated modes each frame
+
+#define BENCH_SCREEN_WIDTH  1920
+#define BENCH_SCREEN_HEIGHT 1080
+
+// The thread scaling benchmarks sample a 4K screen as a 20x15 grid of regions
+#define BENCH_4K_WIDTH  3840
+#define BENCH_4K_HEIGHT 2160
+#define BENCH_GRID_COLS 20
+#define BENCH_GRID_ROWS 15
+
+#define FLOOD_DEVICES 2 // Transmit readers of the settings while update messages flood in
+
+#define THROTTLE_LEDS       300
+#define THROTTLE_READ_LEN   128    // Bytes the slow reader takes at a time
+#define THROTTLE_PAUSE      200000 // ns the slow reader waits between reads
+#define THROTTLE_TIMEOUT    2000   // ms without data after which the slow reader gives up on missing frames
+
+#define CHECK_STRIDE 41 // Framebuffer the mode kernels are checked against each other on
+#define CHECK_HEIGHT 9
+
+typedef void (*BenchFrame)(void *arg);
+
+typedef struct {
+    Config config;
+    unsigned char *ledData;
+    int ledCount;
+} CalculatedBench;
+
+typedef struct {
+    unsigned char *brightness;
+    int ledCount;
+    int useTable;       // Look the wave up in shadow.c's table rather than evaluating it like it used to be
+} ShadowBench;
+
+typedef struct {
+    ModeReducer reducer;
+    const uint32_t *pixels;
+    int ledCount;
+} ReducerBench;
+
+typedef struct {
+    SummedAreaTable table;
+    const uint32_t *pixels;
+    int ledCount;
+    int isWeighted;
+} MeanBench;
+
+typedef struct {
+    CaptureStrip strip;
+    SampleRegion regions[BENCH_GRID_COLS * BENCH_GRID_ROWS];
+    unsigned char *ledData;
+} ScalingBench;
+
+typedef struct {
+    TemporalFilter filter;
+    unsigned char *frames[2]; // Alternated between so the filter always has somewhere to go
+    unsigned char *ledData;
+    int frame;
+} SmoothBench;
+
+typedef struct {
+    SerialWriter writer;
+    LatencyHistogram latencies[NUM_DEVICE_LATENCIES];
+    unsigned char *ledData;
+    unsigned char *encodedData;
+    int ledCount;
+    int compress;
+} SerialBench;
+
+typedef struct {
+    SerialWriter writer;
+    LatencyHistogram latencies[NUM_DEVICE_LATENCIES];
+    unsigned char *ledData;
+    unsigned char *encodedData;
+    int ptyFd;
+    uint32_t framesSent;     // Sequence number of the next frame to write
+    uint32_t framesExpected; // Frames the reader waits for, UINT32_MAX until writing is done, updated atomically
+    uint32_t framesReceived; // Frames the reader decoded intact, updated atomically
+    uint64_t bytesReceived;
+} ThrottledBench;
+
+typedef struct {
+    const char *messages[2]; // Alternated between, each setting the same options to different values
+    Config expected[2];      // What each message leaves the settings at
+    char buffer[MAX_MSG_LEN + 1]; // Reused for every message like the message thread's
+    char *argv[MAX_MSG_LEN / 2 + 1];
+    int message;
+    int isDone;              // Tells the readers to stop, set atomically
+} FloodBench;
+
+typedef struct {
+    FloodBench *flood;
+    int reader;
+    uint64_t changes;   // Times the settings were seen to switch messages
+    pthread_t threadID;
+} FloodReader;
+
+static double runBench(const char *name, BenchFrame frame, void *arg, int framesPerSample);
+static void benchCalculatedFrame(void *arg);
+static void benchShadowFrame(void *arg);
+static void getReferenceBrightness(unsigned char *brightness, int len, double position, double step);
+static void benchReducerFrame(void *arg);
+static void benchMeanFrame(void *arg);
+static void benchScalingFrame(void *arg);
+static void benchSmoothFrame(void *arg);
+static void benchSerialFrame(void *arg);
+static void benchThrottledFrame(void *arg);
+static void* readThrottledPty(void *arg);
+static void getSequencedLedData(unsigned char *colors, int ledCount, uint32_t sequence);
+static void benchFloodFrame(void *arg);
+static void* readFloodedConfig(void *reader);
+static int isSameMessage(const Config *a, const Config *b);
+static void* drainPty(void *ptyFd);
+static void fillPixels(uint32_t *pixels, int isNoisy);
+static void checkShadowTable();
+static void checkModeKernels();
+static void checkRleRoundTrip();
+static void checkSerialBackpressure();
+
+
+int main(int argc, char **argv) {
+    (void)argc;
+    prog    = argv[0];
+    verbose = NO_VERBOSE;
+
+    Config config = {
+        .color         = MULTI,
+        .rotationSpeed = ROT_NORMAL,
+        .rotationDir   = ROT_CW,
+        .shadowLength  = SDW_NORMAL,
+        .fadeSpeed     = FADE_NONE
+    };
+
+    initEffects();
+    initShadowTable();
+    initReducers();
+
+    printf("%-36s %12s %8s %12s\n", "benchmark", "ns/frame", "+/-", "frames/sec");
+
+    // Calculated modes. The LED count is only known at runtime, so every per-LED loop has to stay linear
+    // in it up to installations of several thousand LEDs.
+    int ledCounts[] = {25, 300, 3000};
+    for(int i=0; i<3; i++) {
+        CalculatedBench bench = {
+            .config   = config,
+            .ledCount = ledCounts[i]
+        };
+
+        if((bench.ledData = calloc(6 + bench.ledCount * 3, 1)) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+
+        for(int j=0; j<NUM_EFFECTS; j++) {
+            char name[64];
+            bench.config.color = j;
+            snprintf(name, sizeof(name), "calculated %s %d", effects[j].name, bench.ledCount);
+            printf("%-36s %12.2f ns/LED\n", "", runBench(name, benchCalculatedFrame, &bench, 50000 / bench.ledCount + 1) / bench.ledCount);
+        }
+
+        free(bench.ledData);
+    }
+
+    // The shadow wave on its own, looked up in the table and evaluated with pow() and sin() per LED as it used to be
+    checkShadowTable();
+
+    for(int i=0; i<3; i++) {
+        for(int useTable=0; useTable<2; useTable++) {
+            ShadowBench bench = {
+                .ledCount = ledCounts[i],
+                .useTable = useTable
+            };
+
+            if((bench.brightness = malloc(bench.ledCount)) == NULL) {
+                fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+                exit(ABNORMAL_EXIT);
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "shadow %s %d", useTable ? "table" : "pow/sin", bench.ledCount);
+            printf("%-36s %12.2f ns/LED\n", "", runBench(name, benchShadowFrame, &bench, 20000 / bench.ledCount + 1) / bench.ledCount);
+
+            free(bench.brightness);
+        }
+    }
+
+    // The vector kernels are only any use if they agree with the scalar one exactly
+    checkModeKernels();
+
+    // Mode reducers on a framebuffer split into 25 sample boxes like --sample does
+    uint32_t *pixels;
+    if((pixels = malloc(BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT * sizeof(uint32_t))) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    struct {
+        const char *name;
+        ModeReducer reducer;
+        const char *feature;
+    } reducers[] = {
+        {"scalar",     reduceModeScalar, NULL},
+        {"dispatched", reduceMode,       NULL},
+#if defined(__x86_64__) || defined(__i386__)
+        {"sse2",       reduceModeSse2,   "sse2"},
+        {"avx2",       reduceModeAvx2,   "avx2"},
+#endif
+    };
+
+    for(int isNoisy=0; isNoisy<2; isNoisy++) {
+        fillPixels(pixels, isNoisy);
+
+        for(size_t i=0; i<sizeof(reducers) / sizeof(reducers[0]); i++) {
+#if defined(__x86_64__) || defined(__i386__)
+            if(reducers[i].feature != NULL && !((strcmp(reducers[i].feature, "sse2") == 0 && __builtin_cpu_supports("sse2")) ||
+                                                (strcmp(reducers[i].feature, "avx2") == 0 && __builtin_cpu_supports("avx2")))) {
+                continue;
+            }
+#endif
+            ReducerBench bench = {
+                .reducer  = reducers[i].reducer,
+                .pixels   = pixels,
+                .ledCount = DEFAULT_NUM_LEDS
+            };
+
+            char name[64];
+            snprintf(name, sizeof(name), "reduce %s %s", reducers[i].name, isNoisy ? "noise" : "flat");
+            runBench(name, benchReducerFrame, &bench, 20);
+        }
+
+        // The mean reducers build the table over the whole frame and then look the boxes up
+        for(int isWeighted=0; isWeighted<2; isWeighted++) {
+            MeanBench bench = {
+                .pixels     = pixels,
+                .ledCount   = DEFAULT_NUM_LEDS,
+                .isWeighted = isWeighted
+            };
+
+            char name[64];
+            snprintf(name, sizeof(name), "reduce %s %s", isWeighted ? "weighted" : "mean", isNoisy ? "noise" : "flat");
+            runBench(name, benchMeanFrame, &bench, 20);
+
+            free(bench.table.sums);
+            free(bench.table.weights);
+            free(bench.table.weightedSums);
+        }
+    }
+
+    free(pixels);
+
+    // Every reducer over a 4K screen on a growing number of threads. Nothing is ever
+    // captured here, so the whole screen counts as damaged and every frame rebuilds the
+    // tables and reduces every region.
+    static ScalingBench scalingBench;
+    XImage image = {
+        .width            = BENCH_4K_WIDTH,
+        .height           = BENCH_4K_HEIGHT,
+        .format           = ZPixmap,
+        .byte_order       = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ? LSBFirst : MSBFirst,
+        .bitmap_unit      = 32,
+        .bitmap_bit_order = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ? LSBFirst : MSBFirst,
+        .bitmap_pad       = 32,
+        .depth            = 24,
+        .bytes_per_line   = BENCH_4K_WIDTH * sizeof(uint32_t),
+        .bits_per_pixel   = 32,
+        .red_mask         = 0xff0000,
+        .green_mask       = 0xff00,
+        .blue_mask        = 0xff
+    };
+
+    if((image.data = malloc(BENCH_4K_WIDTH * BENCH_4K_HEIGHT * sizeof(uint32_t))) == NULL ||
+       (scalingBench.ledData = calloc(6 + BENCH_GRID_COLS * BENCH_GRID_ROWS * 3, 1)) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    uint32_t seed = 1;
+    for(int i=0; i<BENCH_4K_WIDTH * BENCH_4K_HEIGHT; i++) {
+        seed = seed * 1103515245 + 12345;
+        ((uint32_t*)image.data)[i] = (seed >> 8) & 0xffffff;
+    }
+
+    scalingBench.strip = (CaptureStrip){.width = BENCH_4K_WIDTH, .height = BENCH_4K_HEIGHT, .scale = 1, .image = &image};
+    for(int i=0; i<BENCH_GRID_COLS * BENCH_GRID_ROWS; i++) {
+        scalingBench.regions[i] = (SampleRegion){
+            .x      = (i % BENCH_GRID_COLS) * (BENCH_4K_WIDTH / BENCH_GRID_COLS),
+            .y      = (i / BENCH_GRID_COLS) * (BENCH_4K_HEIGHT / BENCH_GRID_ROWS),
+            .width  = BENCH_4K_WIDTH / BENCH_GRID_COLS,
+            .height = BENCH_4K_HEIGHT / BENCH_GRID_ROWS,
+            .strip  = &scalingBench.strip,
+            .led    = i
+        };
+    }
+
+    const char *reducerNames[] = {[REDUCER_MEAN] = "mean", [REDUCER_WEIGHTED] = "weighted", [REDUCER_MODE] = "mode"};
+    for(reducer=REDUCER_MEAN; reducer<=REDUCER_MODE; reducer++) {
+        unsigned char *firstLedData = NULL;
+
+        for(int threads=1; threads<=MAX_WORKERS && threads<=sysconf(_SC_NPROCESSORS_ONLN); threads*=2) {
+            startReduceWorkers(threads);
+
+            char name[64];
+            snprintf(name, sizeof(name), "reduce %s 4k %d thread%s", reducerNames[reducer], threads, (threads == 1) ? "" : "s");
+            runBench(name, benchScalingFrame, &scalingBench, 5);
+
+            // However it's split, the frame has to come out the same
+            if(firstLedData == NULL) {
+                firstLedData = malloc(6 + BENCH_GRID_COLS * BENCH_GRID_ROWS * 3);
+                memcpy(firstLedData, scalingBench.ledData, 6 + BENCH_GRID_COLS * BENCH_GRID_ROWS * 3);
+            } else if(memcmp(firstLedData, scalingBench.ledData, 6 + BENCH_GRID_COLS * BENCH_GRID_ROWS * 3) != 0) {
+                fprintf(stderr, "%s: Reducing on %d threads gave a different frame than on one.\n", prog, threads);
+                exit(ABNORMAL_EXIT);
+            }
+        }
+
+        free(firstLedData);
+    }
+
+    reducer = REDUCER_MEAN;
+    free(image.data);
+    free(scalingBench.ledData);
+
+    // Smoothing 300 LEDs towards frames that alternate between two random ones
+    const char *smoothModes[] = {[SMOOTH_EXP] = "exp", [SMOOTH_ADAPTIVE] = "adaptive", [SMOOTH_SCENE_CUT] = "cut"};
+    for(int mode=SMOOTH_EXP; mode<=SMOOTH_SCENE_CUT; mode++) {
+        SmoothBench bench = {.frame = 0};
+        int len = 300 * 3;
+        uint32_t seed = 1;
+
+        for(int i=0; i<2; i++) {
+            if((bench.frames[i] = malloc(len)) == NULL) {
+                fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+                exit(ABNORMAL_EXIT);
+            }
+            for(int j=0; j<len; j++) {
+                seed = seed * 1103515245 + 12345;
+                bench.frames[i][j] = seed >> 24;
+            }
+        }
+        if((bench.ledData = malloc(len)) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+        initTemporalFilter(&bench.filter, mode, DEFAULT_SMOOTH_TIME, len);
+
+        char name[64];
+        snprintf(name, sizeof(name), "smooth %s %s 300", smoothModes[mode], getBlendKernelName());
+        runBench(name, benchSmoothFrame, &bench, 2000);
+
+        free(bench.frames[0]);
+        free(bench.frames[1]);
+        free(bench.ledData);
+        free(bench.filter.state);
+        free(bench.filter.alphas);
+    }
+
+    // Compressed frames have to come back out of the device side decoder exactly as they went in
+    checkRleRoundTrip();
+
+    // Serializing frames of the multi swirl to a pseudo terminal
+    int ptyFd;
+    pthread_t drainThreadID;
+    if((ptyFd = posix_openpt(O_RDWR | O_NOCTTY)) == -1 || grantpt(ptyFd) == -1 || unlockpt(ptyFd) == -1) {
+        fprintf(stderr, "%s: Failed to open a pseudo terminal: %s\n", prog, strerror(errno));
+        exit(ABNORMAL_EXIT);
+    }
+
+    // Keep the terminal open between writers so reads from it never see a hang up
+    if(open(ptsname(ptyFd), O_RDWR | O_NOCTTY) == -1) {
+        fprintf(stderr, "%s: Failed to open a pseudo terminal: %s\n", prog, strerror(errno));
+        exit(ABNORMAL_EXIT);
+    }
+    pthread_create(&drainThreadID, NULL, drainPty, (void*)(intptr_t)ptyFd);
+
+    for(int i=0; i<3; i++) {
+        for(int compress=0; compress<2; compress++) {
+            SerialBench bench = {
+                .ledCount = ledCounts[i],
+                .compress = compress
+            };
+
+            if((bench.ledData = calloc(6 + bench.ledCount * 3, 1)) == NULL || (bench.encodedData = malloc(RLE_MAX_LEN(bench.ledCount))) == NULL) {
+                fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+                exit(ABNORMAL_EXIT);
+            }
+
+            getLedDataHeader(bench.ledData, bench.ledCount);
+            getCalculatedLedData(&config, bench.ledData, 6 + bench.ledCount * 3, BENCH_FRAME_TIME);
+            openSerialWriter(&bench.writer, ptsname(ptyFd));
+
+            char name[64];
+            snprintf(name, sizeof(name), "serial%s %d", compress ? " rle" : "", bench.ledCount);
+            printf("%-36s %12.2f ns/LED\n", "", runBench(name, benchSerialFrame, &bench, 200) / bench.ledCount);
+
+            close(bench.writer.fd);
+            free(bench.ledData);
+            free(bench.encodedData);
+        }
+    }
+
+    // Writing to a device that can't keep up has to wait for it without losing or tearing frames
+    checkSerialBackpressure();
+
+    // Update messages flooding in while every thread that reads the settings is running. Each
+    // message changes several settings at once; a reader must never see some of one and some of the other.
+    // The second message runs on past the end of the first so that parsing it starts on a buffer still
+    // holding pieces of the first, which getopt() mustn't carry on from
+    static FloodBench flood = {
+        .messages = {
+            "colorswirl_update -c red -r fast -d ccw -s long -p 30 -k 3 -S -z",
+            "colorswirl_update -c blue -r very_slow -d cw -s very_small -p 120 -k -1"
+        }
+    };
+
+    // Each message is sent once before the readers start to see what it leaves behind once the other
+    // has been sent before it; the second one leaves the flags the first one turned on alone, like any message
+    initConfig(&config, NUM_CONFIG_READERS(FLOOD_DEVICES));
+    for(int i=0; i<3; i++) {
+        benchFloodFrame(&flood);
+        flood.expected[flood.message] = *acquireConfig(CONFIG_READER_RENDER);
+    }
+
+    FloodReader readers[NUM_CONFIG_READERS(FLOOD_DEVICES)];
+    for(int i=0; i<NUM_CONFIG_READERS(FLOOD_DEVICES); i++) {
+        readers[i] = (FloodReader){.flood = &flood, .reader = i};
+        pthread_create(&readers[i].threadID, NULL, readFloodedConfig, &readers[i]);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "update message %d readers", NUM_CONFIG_READERS(FLOOD_DEVICES));
+    runBench(name, benchFloodFrame, &flood, 1000);
+
+    __atomic_store_n(&flood.isDone, TRUE, __ATOMIC_RELAXED);
+    for(int i=0; i<NUM_CONFIG_READERS(FLOOD_DEVICES); i++) {
+        pthread_join(readers[i].threadID, NULL);
+
+        if(readers[i].changes == 0) {
+            fprintf(stderr, "%s: Settings reader %d never saw an update message.\n", prog, i);
+            exit(ABNORMAL_EXIT);
+        }
+    }
+
+    return NORMAL_EXIT;
+}
+
+
+static double runBench(const char *name, BenchFrame frame, void *arg, int framesPerSample) {
+    double samples[BENCH_SAMPLES];
+    double mean = 0;
+    double variance = 0;
+
+    // One untimed sample to warm up caches and any lazily allocated buffers
+    for(int i=0; i<framesPerSample; i++) {
+        frame(arg);
+    }
+
+    for(int i=0; i<BENCH_SAMPLES; i++) {
+        uint64_t startTime = getMonotonicTime();
+        for(int j=0; j<framesPerSample; j++) {
+            frame(arg);
+        }
+        samples[i] = (double)(getMonotonicTime() - startTime) / framesPerSample;
+        mean += samples[i] / BENCH_SAMPLES;
+    }
+
+    for(int i=0; i<BENCH_SAMPLES; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean) / (BENCH_SAMPLES - 1);
+    }
+
+    printf("%-36s %12.1f %7.1f%% %12.0f\n", name, mean, sqrt(variance) * 100 / mean, 1000000000 / mean);
+    return mean;
+}
+
+
+static void benchCalculatedFrame(void *arg) {
+    CalculatedBench *bench = arg;
+    getCalculatedLedData(&bench->config, bench->ledData, 6 + bench->ledCount * 3, BENCH_FRAME_TIME);
+}
+
+
+static void benchShadowFrame(void *arg) {
+    ShadowBench *bench = arg;
+
+    // The normal shadow length
+    if(bench->useTable) {
+        getShadowBrightness(bench->brightness, bench->ledCount, 0, radiansToPhase(0.3));
+    } else {
+        getReferenceBrightness(bench->brightness, bench->ledCount, 0, 0.3);
+    }
+}
+
+
+static void getReferenceBrightness(unsigned char *brightness, int len, double position, double step) {
+    for(int i=0; i<len; i++, position+=step) {
+        brightness[i] = (int)(pow(0.5 + sin(position) * 0.5, 3.0) * 255.0);
+    }
+}
+
+
+static void benchReducerFrame(void *arg) {
+    ReducerBench *bench = arg;
+    int boxSize = BENCH_SCREEN_WIDTH / bench->ledCount;
+    unsigned char rgb[3];
+
+    for(int i=0; i<bench->ledCount; i++) {
+        bench->reducer(bench->pixels + i * boxSize, BENCH_SCREEN_WIDTH, boxSize, BENCH_SCREEN_HEIGHT, SAMPLE_ROW_STEP, rgb);
+    }
+}
+
+
+static void benchMeanFrame(void *arg) {
+    MeanBench *bench = arg;
+    int boxSize = BENCH_SCREEN_WIDTH / bench->ledCount;
+    unsigned char rgb[3];
+
+    buildSummedAreaTable(&bench->table, bench->pixels, BENCH_SCREEN_WIDTH, BENCH_SCREEN_WIDTH, BENCH_SCREEN_HEIGHT, SAMPLE_ROW_STEP, bench->isWeighted);
+
+    for(int i=0; i<bench->ledCount; i++) {
+        if(bench->isWeighted) {
+            getAreaWeightedMean(&bench->table, i * boxSize, 0, boxSize, bench->table.height, rgb);
+        } else {
+            getAreaMean(&bench->table, i * boxSize, 0, boxSize, bench->table.height, rgb);
+        }
+    }
+}
+
+
+static void benchScalingFrame(void *arg) {
+    ScalingBench *bench = arg;
+
+    if(reducer != REDUCER_MODE) {
+        updateStripTables(&bench->strip, 1);
+    }
+    reduceRegions(bench->regions, BENCH_GRID_COLS * BENCH_GRID_ROWS, bench->ledData);
+}
+
+
+static void benchSmoothFrame(void *arg) {
+    SmoothBench *bench = arg;
+    bench->frame ^= 1;
+    filterFrame(&bench->filter, bench->frames[bench->frame], bench->ledData, BENCH_FRAME_TIME);
+}
+
+
+static void benchSerialFrame(void *arg) {
+    SerialBench *bench = arg;
+    size_t ledDataLen = 6 + bench->ledCount * 3;
+    size_t encodedLen;
+
+    if(bench->compress && (encodedLen = encodeLedData(bench->ledData, ledDataLen, bench->encodedData)) > 0) {
+        sendLedDataToDevice(bench->encodedData, encodedLen, &bench->writer, bench->latencies);
+    } else {
+        sendLedDataToDevice(bench->ledData, ledDataLen, &bench->writer, bench->latencies);
+    }
+}
+
+
+static void benchThrottledFrame(void *arg) {
+    ThrottledBench *bench = arg;
+    size_t ledDataLen = 6 + THROTTLE_LEDS * 3;
+    size_t encodedLen;
+
+    getSequencedLedData(bench->ledData + 6, THROTTLE_LEDS, bench->framesSent++);
+
+    if((encodedLen = encodeLedData(bench->ledData, ledDataLen, bench->encodedData)) > 0) {
+        sendLedDataToDevice(bench->encodedData, encodedLen, &bench->writer, bench->latencies);
+    } else {
+        sendLedDataToDevice(bench->ledData, ledDataLen, &bench->writer, bench->latencies);
+    }
+}
+
+
+static void benchFloodFrame(void *arg) {
+    FloodBench *flood = arg;
+
+    // Exactly what the message thread does with a message once it has received it
+    flood->message = !flood->message;
+    strcpy(flood->buffer, flood->messages[flood->message]);
+
+    // The count given is clipped to the arguments actually in the message
+    if(processMessageArgs(MAX_MSG_LEN, flood->buffer, flood->argv, sizeof(flood->argv) / sizeof(flood->argv[0])) == -1) {
+        exit(ABNORMAL_EXIT);
+    }
+}
+
+
+static void* readFloodedConfig(void *reader) {
+    FloodReader *floodReader = reader;
+    FloodBench *flood = floodReader->flood;
+    unsigned char ledData[6 + DEFAULT_NUM_LEDS * 3];
+    int lastMessage = 0;
+
+    while(!__atomic_load_n(&flood->isDone, __ATOMIC_RELAXED)) {
+        const Config *config = acquireConfig(floodReader->reader);
+        int message = isSameMessage(config, &flood->expected[1]);
+
+        if(!message && !isSameMessage(config, &flood->expected[0])) {
+            fprintf(stderr, "%s: Settings reader %d saw half of an update message.\n", prog, floodReader->reader);
+            exit(ABNORMAL_EXIT);
+        }
+
+        floodReader->changes += (message != lastMessage);
+        lastMessage = message;
+
+        // The render thread renders with what it got while the message thread edits another slot
+        if(floodReader->reader == CONFIG_READER_RENDER) {
+            getCalculatedLedData(config, ledData, sizeof(ledData), BENCH_FRAME_TIME);
+        }
+    }
+
+    return NULL;
+}
+
+
+static int isSameMessage(const Config *a, const Config *b) {
+    return a->color == b->color && a->rotationSpeed == b->rotationSpeed && a->rotationDir == b->rotationDir && a->shadowLength == b->shadowLength &&
+           a->fps == b->fps && a->skipThreshold == b->skipThreshold && a->useCompression == b->useCompression && a->showStats == b->showStats;
+}
+
+
+static void* drainPty(void *ptyFd) {
+    unsigned char buffer[4096];
+
+    while(1) {
+        if(read((int)(intptr_t)ptyFd, buffer, sizeof(buffer)) == -1 && errno != EINTR) {
+            fprintf(stderr, "%s: Error reading pseudo terminal: %s\n", prog, strerror(errno));
+            exit(ABNORMAL_EXIT);
+        }
+    }
+
+    return NULL;
+}
+
+
+static void* readThrottledPty(void *arg) {
+    ThrottledBench *bench = arg;
+    unsigned char buffer[THROTTLE_READ_LEN];
+    unsigned char decodedData[THROTTLE_LEDS * 3];
+    unsigned char expectedData[THROTTLE_LEDS * 3];
+    struct timespec pause = {0, THROTTLE_PAUSE};
+    struct pollfd pollPty = {
+        .fd     = bench->ptyFd,
+        .events = POLLIN
+    };
+
+    RleDecoder decoder;
+    initRleDecoder(&decoder, decodedData, THROTTLE_LEDS);
+
+    while(bench->framesReceived < __atomic_load_n(&bench->framesExpected, __ATOMIC_RELAXED)) {
+        int isReady = poll(&pollPty, 1, THROTTLE_TIMEOUT);
+        ssize_t bytesRead = 0;
+
+        if(isReady == 1) {
+            bytesRead = read(bench->ptyFd, buffer, sizeof(buffer));
+        } else if(isReady == 0 && __atomic_load_n(&bench->framesExpected, __ATOMIC_RELAXED) != UINT32_MAX) {
+            fprintf(stderr, "%s: A slow reader got %u of %u frames.\n", prog, bench->framesReceived, bench->framesExpected);
+            exit(ABNORMAL_EXIT);
+        }
+
+        if((isReady == -1 || bytesRead == -1) && errno != EINTR) {
+            fprintf(stderr, "%s: Error reading pseudo terminal: %s\n", prog, strerror(errno));
+            exit(ABNORMAL_EXIT);
+        }
+
+        // Every frame has to be the next one and exactly as it was written, whether it was encoded or not
+        for(ssize_t i=0; i<bytesRead; i++) {
+            if(decodeLedData(&decoder, buffer[i])) {
+                getSequencedLedData(expectedData, THROTTLE_LEDS, bench->framesReceived);
+
+                if(decoder.numLeds != THROTTLE_LEDS || memcmp(decodedData, expectedData, sizeof(expectedData)) != 0) {
+                    fprintf(stderr, "%s: Frame %u reached a slow reader torn or out of order.\n", prog, bench->framesReceived);
+                    exit(ABNORMAL_EXIT);
+                }
+
+                bench->framesReceived++;
+            }
+        }
+
+        bench->bytesReceived += (bytesRead > 0) ? bytesRead : 0;
+        nanosleep(&pause, NULL);
+    }
+
+    return NULL;
+}
+
+
+static void getSequencedLedData(unsigned char *colors, int ledCount, uint32_t sequence) {
+    // The first LED carries the sequence number so a lost or repeated frame can't go unnoticed
+    colors[0] = sequence >> 16;
+    colors[1] = sequence >> 8;
+    colors[2] = sequence >> 0;
+
+    // Even frames are runs of four LEDs and get run-length encoded, odd frames have no runs and go out plain
+    for(int led=1; led<ledCount; led++) {
+        for(int c=0; c<3; c++) {
+            colors[led * 3 + c] = (sequence % 2) ? sequence + led * 7 + c * 85 : sequence + (led / 4) * 3 + c;
+        }
+    }
+}
+
+
+static void fillPixels(uint32_t *pixels, int isNoisy) {
+    // A flat screen is a few large windows of solid color, like a typical desktop
+    uint32_t seed = 1;
+
+    for(int y=0; y<BENCH_SCREEN_HEIGHT; y++) {
+        for(int x=0; x<BENCH_SCREEN_WIDTH; x++) {
+            seed = seed * 1103515245 + 12345;
+            pixels[y * BENCH_SCREEN_WIDTH + x] = isNoisy ? (seed >> 8) & 0xffffff : ((x / 400) * 0x302010 + (y / 300) * 0x102030) & 0xffffff;
+        }
+    }
+}
+
+
+static void checkModeKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+    struct {
+        const char *name;
+        ModeReducer reducer;
+        int isSupported;
+    } kernels[] = {
+        {"sse2", reduceModeSse2, __builtin_cpu_supports("sse2")},
+        {"avx2", reduceModeAvx2, __builtin_cpu_supports("avx2")}
+    };
+
+    // Room past the last row for regions that start a few pixels in
+    uint32_t pixels[CHECK_STRIDE * (CHECK_HEIGHT + 1)];
+    const char *patterns[] = {"random", "flat", "runs", "ties"};
+    uint32_t seed = 1;
+
+    for(int pattern=0; pattern<4; pattern++) {
+        for(int i=0; i<CHECK_STRIDE * (CHECK_HEIGHT + 1); i++) {
+            seed = seed * 1103515245 + 12345;
+
+            switch(pattern) {
+                case 0: pixels[i] = seed; break;
+                case 1: pixels[i] = 0xff336699; break;
+                // Runs of a few pixels so vectors are sometimes uniform and sometimes not
+                case 2: pixels[i] = (i == 0 || (seed >> 16) % 6 == 0) ? (seed >> 4) & 0xffffff : pixels[i - 1]; break;
+                // Two values per channel so the counts often tie
+                default: pixels[i] = ((seed >> 8) & 0x010101) * 0x40; break;
+            }
+        }
+
+        // Odd widths leave tails after the vectors and the offsets leave them unaligned
+        for(int width=1; width<=37; width++) {
+            for(int height=1; height<=CHECK_HEIGHT; height++) {
+                for(int rowStep=1; rowStep<=4; rowStep++) {
+                    for(int offset=0; offset<4 && offset+width<=CHECK_STRIDE; offset++) {
+                        unsigned char expected[3];
+                        reduceModeScalar(pixels + offset, CHECK_STRIDE, width, height, rowStep, expected);
+
+                        for(int k=0; k<2; k++) {
+                            unsigned char rgb[3];
+
+                            if(!kernels[k].isSupported) {
+                                continue;
+                            }
+
+                            kernels[k].reducer(pixels + offset, CHECK_STRIDE, width, height, rowStep, rgb);
+
+                            if(memcmp(rgb, expected, sizeof(rgb)) != 0) {
+                                fprintf(stderr, "%s: The %s mode kernel disagrees with the scalar one on %s pixels (%dx%d, row step %d, offset %d).\n",
+                                        prog, kernels[k].name, patterns[pattern], width, height, rowStep, offset);
+                                exit(ABNORMAL_EXIT);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+#endif
+}
+
+
+static void checkRleRoundTrip() {
+    // Counts around the most a token can cover and a few typical strips
+    int ledCounts[] = {1, 2, 3, RLE_MAX_COUNT - 1, RLE_MAX_COUNT, RLE_MAX_COUNT + 1, 2 * RLE_MAX_COUNT, 2 * RLE_MAX_COUNT + 1, 300, 1000};
+    const char *patterns[] = {"random", "uniform", "alternating", "paired", "max runs"};
+    int maxLeds = 1000;
+
+    unsigned char *ledData = malloc(6 + maxLeds * 3);
+    unsigned char *encodedData = malloc(RLE_MAX_LEN(maxLeds));
+    unsigned char *decodedData = malloc(maxLeds * 3);
+    if(ledData == NULL || encodedData == NULL || decodedData == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    // Something that looks almost like a header, as left over from a frame cut short
+    const unsigned char garbage[] = {'A', 'd', 'r', 0x00, 0x00, 0x00, 'A', 'd'};
+    uint32_t seed = 1;
+
+    for(size_t i=0; i<sizeof(ledCounts) / sizeof(ledCounts[0]); i++) {
+        int ledCount = ledCounts[i];
+        size_t ledDataLen = 6 + ledCount * 3;
+
+        for(int pattern=0; pattern<5; pattern++) {
+            getLedDataHeader(ledData, ledCount);
+
+            for(int led=0; led<ledCount; led++) {
+                seed = seed * 1103515245 + 12345;
+
+                for(int c=0; c<3; c++) {
+                    switch(pattern) {
+                        case 0: ledData[6 + led * 3 + c] = seed >> (8 * c + 8); break;
+                        case 1: ledData[6 + led * 3 + c] = 0x42 + c; break;
+                        case 2: ledData[6 + led * 3 + c] = (led % 2) ? 0xff : c; break;
+                        case 3: ledData[6 + led * 3 + c] = ((led / 2) % 2) ? 0xff : c; break;
+                        // Runs one short of, exactly and one over the longest token, each followed by a lone LED
+                        default: {
+                            int position = led % (3 * RLE_MAX_COUNT + 3);
+                            int isLone = (position == RLE_MAX_COUNT - 1 || position == 2 * RLE_MAX_COUNT || position == 3 * RLE_MAX_COUNT + 2);
+                            ledData[6 + led * 3 + c] = isLone ? 0x10 * c : 0x80 + c;
+                        }
+                    }
+                }
+            }
+
+            // Fall back to the plain frame the way the transmit threads do
+            size_t encodedLen = encodeLedData(ledData, ledDataLen, encodedData);
+            const unsigned char *frame = (encodedLen > 0) ? encodedData : ledData;
+            size_t frameLen = (encodedLen > 0) ? encodedLen : ledDataLen;
+
+            if(pattern == 1 && ledCount > 2 && encodedLen == 0) {
+                fprintf(stderr, "%s: A uniform frame of %d LEDs didn't get run-length encoded.\n", prog, ledCount);
+                exit(ABNORMAL_EXIT);
+            }
+
+            // Twice in a row to make sure the decoder is ready for the next frame when it's done with one
+            RleDecoder decoder;
+            initRleDecoder(&decoder, decodedData, maxLeds);
+
+            for(size_t j=0; j<sizeof(garbage); j++) {
+                decodeLedData(&decoder, garbage[j]);
+            }
+
+            for(int repeat=0; repeat<2; repeat++) {
+                memset(decodedData, 0, ledCount * 3);
+
+                for(size_t j=0; j<frameLen; j++) {
+                    if(decodeLedData(&decoder, frame[j]) != (j == frameLen - 1)) {
+                        fprintf(stderr, "%s: Decoding a %s frame of %d LEDs ended at byte %zu of %zu.\n", prog, patterns[pattern], ledCount, j + 1, frameLen);
+                        exit(ABNORMAL_EXIT);
+                    }
+                }
+
+                if(memcmp(decodedData, ledData + 6, ledCount * 3) != 0) {
+                    fprintf(stderr, "%s: A %s frame of %d LEDs decoded differently than it was encoded.\n", prog, patterns[pattern], ledCount);
+                    exit(ABNORMAL_EXIT);
+                }
+            }
+        }
+    }
+
+    free(ledData);
+    free(encodedData);
+    free(decodedData);
+}
+
+
+static void checkSerialBackpressure() {
+    ThrottledBench bench = {.framesExpected = UINT32_MAX};
+    pthread_t readThreadID;
+
+    if((bench.ledData = malloc(6 + THROTTLE_LEDS * 3)) == NULL || (bench.encodedData = malloc(RLE_MAX_LEN(THROTTLE_LEDS))) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    if((bench.ptyFd = posix_openpt(O_RDWR | O_NOCTTY)) == -1 || grantpt(bench.ptyFd) == -1 || unlockpt(bench.ptyFd) == -1) {
+        fprintf(stderr, "%s: Failed to open a pseudo terminal: %s\n", prog, strerror(errno));
+        exit(ABNORMAL_EXIT);
+    }
+
+    getLedDataHeader(bench.ledData, THROTTLE_LEDS);
+    openSerialWriter(&bench.writer, ptsname(bench.ptyFd));
+    pthread_create(&readThreadID, NULL, readThrottledPty, &bench);
+
+    // Far more than the terminal can buffer, so writes have to keep waiting on the reader
+    char name[64];
+    snprintf(name, sizeof(name), "serial throttled %d", THROTTLE_LEDS);
+    runBench(name, benchThrottledFrame, &bench, 50);
+
+    __atomic_store_n(&bench.framesExpected, bench.framesSent, __ATOMIC_RELAXED);
+    pthread_join(readThreadID, NULL);
+
+    if(getWriteStalls(&bench.writer) == 0) {
+        fprintf(stderr, "%s: Writing to a slow reader never waited for room in the output queue.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    // Frames are checked as they arrive; nothing else may have been read in between them
+    if(bench.bytesReceived != getBytesWritten(&bench.writer)) {
+        fprintf(stderr, "%s: A slow reader got %llu bytes of %llu written.\n", prog,
+            (unsigned long long)bench.bytesReceived, (unsigned long long)getBytesWritten(&bench.writer));
+        exit(ABNORMAL_EXIT);
+    }
+
+    close(bench.writer.fd);
+    close(bench.ptyFd);
+    free(bench.ledData);
+    free(bench.encodedData);
+}
+
+
+static void checkShadowTable() {
+    unsigned char brightness[4096];
+    unsigned char expected[4096];
+
+    // Every 4096th phase around the turn, then runs of LEDs at each shadow length from all over it
+    double steps[] = {2 * M_PI / 1048576, 0.9, 0.6, 0.3, 0.2, 0.08};
+    uint32_t seed = 1;
+
+    for(int i=0; i<6; i++) {
+        for(int run=0; run<256; run++) {
+            Phase phase;
+            double position;
+
+            if(i == 0) {
+                phase = (Phase)run * 4096 * 4096;
+                position = run * 4096 * steps[0];
+            } else {
+                seed = seed * 1103515245 + 12345;
+                phase = seed;
+                position = (double)seed * 2 * M_PI / 4294967296.0;
+            }
+
+            // The reference steps by the same fixed-point step; only the way the wave is evaluated differs
+            Phase step = radiansToPhase(steps[i]);
+            getShadowBrightness(brightness, 4096, phase, step);
+            getReferenceBrightness(expected, 4096, position, (double)step * 2 * M_PI / 4294967296.0);
+
+            for(int led=0; led<4096; led++) {
+                if(abs(brightness[led] - expected[led]) > 1) {
+                    fprintf(stderr, "%s: The shadow table is off by %d from the pow()/sin() curve at LED %d of a run with step %g.\n",
+                            prog, brightness[led] - expected[led], led, steps[i]);
+                    exit(ABNORMAL_EXIT);
+                }
+            }
+        }
+    }
+}
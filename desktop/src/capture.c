@@ -0,0 +1,173 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Screen capture for the sample mode. The sample regions are grouped into a few
+ * capture strips which are each grabbed with a single request once per frame;
+ * the reducers then read their regions out of the strip images.
+ *
+ * The pixels come from a frame source: the X11 root window (x11.c) or, with --input,
+ * a stream of video frames (video.c). This file keeps what's common to all of them:
+ * the strips, their scale and which parts of the screen changed since the last frame.
+ * Strips that don't touch any changed part are not captured again and the sampler only
+ * reduces the regions that do.
+ *
+ */
+
+#include "colorswirl.h"
+#include "capture.h"
+#include "source.h"
+
+static const FrameSource *source;               // Where the frames come from
+
+static CaptureStrip strips[MAX_CAPTURE_STRIPS]; // Screen areas grabbed each frame
+static int numStrips;                           // Number of strips in use
+static unsigned long captureRequests;           // Requests made by the last call to captureFrame()
+static XRectangle *damagedRects;                // Parts of the screen drawn to since the previous frame
+static int numDamagedRects;
+static int isFullyDamaged = TRUE;               // Flag for treating the whole screen as damaged this frame
+static int hasCaptured;                         // Flag for a frame having been captured already
+static int stripScale;                          // Capture scale new strips are set up for
+
+
+void openFrameSource() {
+    if(source == NULL) {
+        source = (inputSpec != NULL) ? &videoSource : &x11Source;
+        source->open();
+
+        // The source may have had to turn downscaling off
+        stripScale = captureScale;
+
+        if(verbose >= VERBOSE) {
+            printf("%s: Sampling %dx%d frames from %s\n", prog, screenWidth, screenHeight, source->name);
+        }
+    }
+}
+
+
+int isAreaDamaged(int x, int y, int width, int height) {
+    if(isFullyDamaged) {
+        return TRUE;
+    }
+
+    for(int i=0; i<numDamagedRects; i++) {
+        XRectangle *rect = &damagedRects[i];
+
+        if(x < rect->x + rect->width && rect->x < x + width && y < rect->y + rect->height && rect->y < y + height) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+int hasScreenChanged() {
+    return source->hasScreenChanged();
+}
+
+
+const XRectangle* getScreenOutputs(int *numOutputs) {
+    return source->getOutputs(numOutputs);
+}
+
+
+int addCaptureStrip(int x, int y, int width, int height) {
+    if(numStrips == MAX_CAPTURE_STRIPS) {
+        fprintf(stderr, "%s: Too many capture strips.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    CaptureStrip *strip = &strips[numStrips];
+    strip->x      = x;
+    strip->y      = y;
+    strip->width  = width;
+    strip->height = height;
+    strip->scale  = stripScale;
+
+    source->createStrip(strip);
+
+    return numStrips++;
+}
+
+
+int setCaptureStripScale(int scale) {
+    if(!source->setScale(scale)) {
+        return FALSE;
+    }
+
+    // All strips go before any is set up again so the source can hand out what they had from the start
+    for(int i=0; i<numStrips; i++) {
+        source->destroyStrip(&strips[i]);
+    }
+    for(int i=0; i<numStrips; i++) {
+        strips[i].scale = scale;
+        source->createStrip(&strips[i]);
+    }
+
+    // The new images are empty until captured in full
+    stripScale = scale;
+    hasCaptured = FALSE;
+    return TRUE;
+}
+
+
+void clearCaptureStrips() {
+    // The tables stay with the strip slots for whichever strips are added next
+    for(int i=0; i<numStrips; i++) {
+        source->destroyStrip(&strips[i]);
+    }
+
+    numStrips = 0;
+    hasCaptured = FALSE;
+}
+
+
+int canScaleCaptures() {
+    return source->canScale();
+}
+
+
+void invalidateCapture() {
+    hasCaptured = FALSE;
+}
+
+
+CaptureStrip* getCaptureStrips(int *numCaptureStrips) {
+    *numCaptureStrips = numStrips;
+    return strips;
+}
+
+
+void captureFrame() {
+    unsigned long firstRequest = source->getRequests();
+
+    // The first frame is always captured in full
+    isFullyDamaged = source->fetchDamage(&damagedRects, &numDamagedRects) || !hasCaptured;
+
+    for(int i=0; i<numStrips; i++) {
+        // Otherwise the strip image still holds what's on the screen
+        if(isAreaDamaged(strips[i].x, strips[i].y, strips[i].width, strips[i].height)) {
+            source->captureStrip(&strips[i]);
+        }
+    }
+
+    captureRequests = source->getRequests() - firstRequest;
+    hasCaptured = TRUE;
+}
+
+
+unsigned long getCaptureRequests() {
+    return captureRequests;
+}
+
+
+int getScaledSize(int size, int scale) {
+    // Anything on the screen at all is at least one pixel once shrunk
+    return (size + scale - 1) / scale;
+}
@@ -0,0 +1,57 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+
+struct SummedAreaTable;
+
+#define MAX_OUTPUTS        4  // Monitors that can be sampled at once
+#define MAX_CAPTURE_STRIPS 16 // One per edge of the layout per output
+#define MAX_CAPTURE_SCALE  16 // Largest factor the X server can be asked to shrink the screen by
+
+typedef struct CaptureStrip {
+    int x;         // Position and size of the strip on the screen
+    int y;
+    int width;
+    int height;
+    int isShm;     // Flag for the strip's image living in the shared memory segment
+    int scale;     // Factor the strip is shrunk by on the X server before it is fetched; 1 for none
+    Pixmap pixmap; // Where the X server renders the shrunk strip when scaling
+    Picture picture;
+    XImage *image; // Pixels of the strip as of the last call to captureFrame(), shrunk by scale
+    struct SummedAreaTable *table; // Sums over the image for the mean reducers
+} CaptureStrip;
+
+// The part of the screen one LED takes its color from
+typedef struct SampleRegion {
+    int x;
+    int y;
+    int width;
+    int height;
+    CaptureStrip *strip; // Strip the region is read out of
+    int led;             // LED of the frame the region fills
+} SampleRegion;
+
+void openFrameSource();
+int hasScreenChanged();
+const XRectangle* getScreenOutputs(int *numOutputs);
+int addCaptureStrip(int x, int y, int width, int height);
+void clearCaptureStrips();
+CaptureStrip* getCaptureStrips(int *numCaptureStrips);
+void captureFrame();
+int setCaptureStripScale(int scale);
+int canScaleCaptures();
+void invalidateCapture();
+int isAreaDamaged(int x, int y, int width, int height);
+unsigned long getCaptureRequests();
+int getScaledSize(int size, int scale);
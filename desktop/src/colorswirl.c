@@ -18,36 +18,158 @@
  */
 
 #include "colorswirl.h"
+#include "capture.h"
+#include "config.h"
+#include "effect.h"
+#include "export.h"
+#include "filter.h"
+#include "integral.h"
+#include "latency.h"
+#include "layout.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "quality.h"
+#include "reduce.h"
+#include "rle.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "shadow.h"
 #include "usage.h"
 
+char *prog;
+int verbose;
+int screenWidth;
+int screenHeight;
+int numLeds;
+Display *XDisplay;
+char gammaCorrection[256][3];
+
+int noFork;
+int isScreenSampling;
+int useShm;
+int useDamage;
+int reducer;
+int smoothMode;
+int smoothTime;
+int captureScale;
+double frameBudget;
+int numWorkers;
+char *statsSocket;
+char *layoutFile;
+char *inputSpec;
+char *outputNames;
+
+// A serial LED controller driving a segment of the LEDs, with its own transmit stage
+typedef struct {
+    SerialWriter writer;
+    int firstLed;         // Index of the first LED of the segment
+    int numLeds;          // Number of LEDs in the segment
+    TripleBuffer frames;  // Frames passed from the compute stage to this device's transmit stage
+    PipelineStage stage;  // Transmit stage of this device
+    unsigned char *encodedData; // Run-length encoded frame when compressing
+    int configReader;           // Reader the transmit stage acquires the settings as
+    unsigned char *sentData;    // Last frame sent, to hold back frames that haven't changed
+    uint64_t lastSendTime;      // When sentData was sent
+    uint64_t skippedFrames;     // Frames held back because they hadn't changed, updated atomically
+    uint64_t reportedSkipped;   // Frames held back as of the last statistics report
+    LatencyHistogram latencies[NUM_DEVICE_LATENCIES];
+    uint64_t reportedFrames;    // Frames written as of the last statistics report
+    uint64_t reportedBytes;     // Bytes written as of the last statistics report
+    pthread_t threadID;
+} Device;
+
+static Device *devices;             // Devices the frames are split between
+static int numDevices;
+static TripleBuffer capturedFrames; // Frames passed from the capture stage to the compute stage
+static FrameScheduler scheduler;    // Paces the capture stage
+static PipelineStage stages[NUM_STAGES] = {
+    [STAGE_CAPTURE]  = {.name = "capture"},
+    [STAGE_COMPUTE]  = {.name = "compute"}
+};
+static LatencyHistogram latencies[NUM_LATENCIES] = {
+    [LATENCY_CAPTURE] = {.name = "capture"},
+    [LATENCY_REDUCE]  = {.name = "reduce"},
+    [LATENCY_BLEND]   = {.name = "blend"}
+};
+static uint64_t regionsReduced;     // Sample regions reduced since startup; undamaged ones are skipped
+static QualityController quality;   // Trades sampling quality for capture time with --budget
+static int qualityScale = 1;        // Capture scale the strips are set up for
+static int qualityRowStep = 1;      // Multiplies the sampling row step
+static WorkerPool reducePool;       // Threads the reduction of each sampled frame is split between
+
+// One band of the summed-area table of a strip, built on whichever worker takes it
+typedef struct {
+    CaptureStrip *strip;
+    int band;
+} TableBand;
+
+// What each worker found while reducing regions, on a cache line of its own so workers don't slow each other down
+typedef struct {
+    int numReduced;
+    int isChanged;
+} __attribute__((aligned(CACHE_LINE_SIZE))) ReduceWorker;
+
+typedef struct {
+    const SampleRegion *regions;
+    unsigned char (*regionColors)[3]; // Color of each region as of the last time it was reduced
+    unsigned char *ledData;
+    ReduceWorker workers[MAX_WORKERS];
+} RegionJob;
+
+static void buildTableBand(void *bands, int worker, int item);
+static void reduceRegion(void *job, int worker, int item);
+static const uint32_t* convertPixels(XImage *image, int x, int y, int width, int numRows, int rowStep);
+
+// The benchmarks in bench.c bring their own main()
+#ifndef BENCH
 int main(int argc, char **argv) {
-    int deviceDescriptor;
-    char *device = NULL;
+    char **deviceSpecs = NULL;
+    int numDeviceSpecs = 0;
     pthread_t threadID;
-
-    // LED color info to send to the device
-    // Size is 6 byte header + 3 bytes per LED
-    unsigned char ledData[6 + (NUM_LEDS * 3)];
-    unsigned char prevLedData[6 + (NUM_LEDS * 3)];
+    pthread_t captureThreadID;
+    pthread_t computeThreadID;
+    Config config;
 
     // Init globals
     prog             = argv[0];
     noFork           = 0;
     isScreenSampling = 0;
+    useShm           = 1;
+    useDamage        = 1;
+    reducer          = REDUCER_MEAN;
+    smoothMode       = SMOOTH_EXP;
+    smoothTime       = DEFAULT_SMOOTH_TIME;
+    captureScale     = 1;
+    frameBudget      = 0;
+    numWorkers       = getDefaultWorkers();
     XDisplay         = NULL;
-    startTime        = prevTime = time(NULL);
-    color            = MULTI;
-    rotationSpeed    = ROT_NORMAL;
-    rotationDir      = ROT_CW;
-    shadowLength     = SDW_NORMAL;
-    fadeSpeed        = FADE_NONE;
+    config.color          = MULTI;
+    config.rotationSpeed  = ROT_NORMAL;
+    config.rotationDir    = ROT_CW;
+    config.shadowLength   = SDW_NORMAL;
+    config.fadeSpeed      = FADE_NONE;
+    config.useCompression = 0;
+    config.skipThreshold  = 0;
+    config.fps            = DEFAULT_FPS;
+    config.showStats      = 0;
+    numLeds          = DEFAULT_NUM_LEDS;
+    statsSocket      = NULL;
+    layoutFile       = NULL;
+    inputSpec        = NULL;
+    outputNames      = NULL;
 
     installSigHandler(SIGINT, sigHandler);
     installSigHandler(SIGTERM, sigHandler);
 
-    if(processArgs(argc, argv, &device) == -1) {
+    if(processArgs(argc, argv, &deviceSpecs, &numDeviceSpecs, &config) == -1) {
         exit(ABNORMAL_EXIT);
     }
+    initConfig(&config, NUM_CONFIG_READERS(numDeviceSpecs));
+
+    // The layout decides how many LEDs there are so it has to be read before the devices are set up
+    if(isScreenSampling && layoutFile != NULL) {
+        readLayout(layoutFile);
+    }
 
     // This is a system service. Fork and return control to whatever started us unless requested otherwise
     pid_t pid;
@@ -62,35 +184,70 @@ int main(int argc, char **argv) {
 
     startMessageThread(&threadID);
 
-    deviceDescriptor = openDevice(device);
+    openDevices(deviceSpecs, numDeviceSpecs);
 
-    getLedDataHeader(ledData);
+    if(statsSocket != NULL) {
+        startStatsServer(statsSocket, writeStatsSnapshot);
+    }
+    initEffects();
+    initShadowTable();
+
+    // LED color info passed between the pipeline stages
+    initTripleBuffer(&capturedFrames, LED_DATA_LEN);
+    for(int i=0; i<3; i++) {
+        getLedDataHeader(capturedFrames.buffers[i], numLeds);
+    }
 
     if(isScreenSampling) {
-        memset(prevLedData, 0, sizeof(prevLedData));
-        openXDisplay();
-        getScreenResolution();
-        calculateSamplePoints();
+        openFrameSource();
+        if(!compileLayout()) {
+            exit(ABNORMAL_EXIT);
+        }
         calculateGammaTable();
+        initReducers();
+        startReduceWorkers(numWorkers);
+
+        if(frameBudget > 0) {
+            qualityScale = captureScale;
+            initQualityController(&quality, frameBudget, canScaleCaptures());
+        }
+
+        if(verbose >= VERBOSE && reducer == REDUCER_MODE) {
+            printf("%s: Using mode reducer, starting on the %s kernel\n", prog, getModeReducerName());
+        } else if(verbose >= VERBOSE) {
+            printf("%s: Using %s reducer\n", prog, (reducer == REDUCER_WEIGHTED) ? "weighted mean" : "mean");
+        }
+    }
+
+    // Capture, compute and each device's transmit stage run on their own threads
+    pthread_create(&captureThreadID, NULL, captureLoop, NULL);
+    pthread_create(&computeThreadID, NULL, computeLoop, NULL);
+    for(int i=0; i<numDevices; i++) {
+        pthread_create(&devices[i].threadID, NULL, transmitLoop, &devices[i]);
     }
 
+    // Update statistics once per second
     while(1) {
-        if(isScreenSampling) {
-            getSampledLedData(ledData, prevLedData);
-            updatePrevLedData(ledData, prevLedData, sizeof(ledData));
-        } else {
-            getCalculatedLedData(ledData, sizeof(ledData));
+        sleep(1);
+
+        if(verbose >= VERBOSE) {
+            printStatistics();
         }
 
-        sendLedDataToDevice(ledData, sizeof(ledData), deviceDescriptor);
+        if(acquireConfig(CONFIG_READER_MAIN)->showStats) {
+            printLatencies();
+        }
     }
 
-    // Close the device and unlink the message queue
-    close(deviceDescriptor);
+    // Close the devices and unlink the message queue
+    for(int i=0; i<numDevices; i++) {
+        close(devices[i].writer.fd);
+    }
     mq_unlink(MQ_NAME);
 
     return 0;
 }
+#endif
 
 
 void startMessageThread(pthread_t *threadID) {
@@ -98,91 +255,242 @@ void startMessageThread(pthread_t *threadID) {
 }
 
 
-int openDevice(char *device) {
-    int deviceDescriptor = -1;
-    struct termios tty;
+void openDevices(char **deviceSpecs, int numDeviceSpecs) {
+    int numAssignedLeds = 0;
+    int numUnassignedDevices = 0;
 
-    // Try to open the device
-    if((deviceDescriptor = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
-        fprintf(stderr, "%s: Error opening device \"%s\": %s\n", prog, device, strerror(errno));
+    if((devices = calloc(numDeviceSpecs, sizeof(Device))) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
         exit(ABNORMAL_EXIT);
     }
+    numDevices = numDeviceSpecs;
 
-    // Serial port config swiped from RXTX library (rxtx.qbang.org):
-    tcgetattr(deviceDescriptor, &tty);
-    tty.c_iflag     = INPCK;
-    tty.c_lflag     = 0;
-    tty.c_oflag     = 0;
-    tty.c_cflag     = CREAD | CS8 | CLOCAL;
-    tty.c_cc[VMIN]  = 0;
-    tty.c_cc[VTIME] = 0;
-    cfsetispeed(&tty, B115200);
-    cfsetospeed(&tty, B115200);
-    tcsetattr(deviceDescriptor, TCSANOW, &tty);
+    // Devices are given as "path[:count]". Split off the LED count if there is one.
+    for(int i=0; i<numDevices; i++) {
+        char *countSeparator = strrchr(deviceSpecs[i], ':');
 
-    return deviceDescriptor;
-}
+        if(countSeparator != NULL) {
+            *countSeparator = '\0';
 
+            if(sscanf(countSeparator + 1, "%d", &devices[i].numLeds) != 1 || devices[i].numLeds < 1) {
+                fprintf(stderr, "%s: Invalid LED count for device \"%s\".\n", prog, deviceSpecs[i]);
+                exit(ABNORMAL_EXIT);
+            }
 
-void getLedDataHeader(unsigned char *ledData) {
-    // Define the header of the LED data to be sent to the Arduino each loop iteration
-    ledData[0] = 'A';                            // Magic word
-    ledData[1] = 'd';
-    ledData[2] = 'a';
-    ledData[3] = (NUM_LEDS - 1) >> 8;            // LED count high byte
-    ledData[4] = (NUM_LEDS - 1) & 0xff;          // LED count low byte
-    ledData[5] = ledData[3] ^ ledData[4] ^ 0x55; // Checksum
-}
+            numAssignedLeds += devices[i].numLeds;
+        } else {
+            numUnassignedDevices++;
+        }
+    }
 
+    // If every device has a count the strip is made up of just those LEDs
+    if(numUnassignedDevices == 0) {
+        numLeds = numAssignedLeds;
+    }
 
-void updatePrevLedData(unsigned char *ledData, unsigned char *prevLedData, int ledDataLen) {
-    for(int i=0; i<ledDataLen; i++) {
-        prevLedData[i] = ledData[i];
+    if(numAssignedLeds + numUnassignedDevices > numLeds || numLeds > MAX_NUM_LEDS) {
+        fprintf(stderr, "%s: The device LED counts don't fit in %d LEDs.\n", prog, numLeds);
+        exit(ABNORMAL_EXIT);
     }
-}
 
+    // Split whatever is left evenly between the devices without a count and lay the segments out in order
+    int numRemainingLeds = numLeds - numAssignedLeds;
+    for(int i=0, firstLed=0; i<numDevices; i++) {
+        Device *device = &devices[i];
+
+        if(device->numLeds == 0) {
+            device->numLeds = numRemainingLeds / numUnassignedDevices + (numRemainingLeds % numUnassignedDevices > 0 ? 1 : 0);
+            numRemainingLeds -= device->numLeds;
+            numUnassignedDevices--;
+        }
 
-void openXDisplay() {
-    if(XDisplay == NULL) {
-        XDisplay = XOpenDisplay(NULL);
+        device->firstLed = firstLed;
+        firstLed += device->numLeds;
+        device->configReader = CONFIG_READER_TRANSMIT + i;
 
-        if(XDisplay == NULL) {
-            fprintf(stderr, "%s: Could not open X display.\n", prog);
+        openSerialWriter(&device->writer, deviceSpecs[i]);
+        device->stage.name = deviceSpecs[i];
+        device->latencies[LATENCY_SERIALIZE].name = "serialize";
+        device->latencies[LATENCY_DRAIN].name = "drain";
+        device->latencies[LATENCY_WRITE].name = "write";
+
+        initTripleBuffer(&device->frames, DEVICE_DATA_LEN(device));
+        if((device->encodedData = malloc(RLE_MAX_LEN(device->numLeds))) == NULL || (device->sentData = malloc(DEVICE_DATA_LEN(device))) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
             exit(ABNORMAL_EXIT);
         }
+
+        for(int j=0; j<3; j++) {
+            getLedDataHeader(device->frames.buffers[j], device->numLeds);
+        }
+
+        if(verbose >= VERBOSE) {
+            printf("%s: Sending LEDs %d-%d to \"%s\"\n", prog, device->firstLed, device->firstLed + device->numLeds - 1, deviceSpecs[i]);
+        }
     }
 }
 
 
-void getScreenResolution() {
-    XWindowAttributes attrs;
-    XGetWindowAttributes(XDisplay, DefaultRootWindow(XDisplay), &attrs);
+void* captureLoop(void *threadID) {
+    // Do something with threadID to make GCC happy and get rid of the unused parameter warning
+    (void)threadID;
 
-    screenWidth = attrs.width - 1440;
-    screenHeight = attrs.height;
+    const Config *config = acquireConfig(CONFIG_READER_RENDER);
+    int scheduledFps = config->fps;
+    initFrameScheduler(&scheduler, scheduledFps);
+
+    while(1) {
+        double elapsed = waitForNextFrame(&scheduler);
+        unsigned char *ledData = getWriteFrame(&capturedFrames);
+
+        // Settings only change between frames
+        config = acquireConfig(CONFIG_READER_RENDER);
+        if(config->fps != scheduledFps) {
+            scheduledFps = config->fps;
+            setFrameRate(&scheduler, scheduledFps);
+        }
+
+        beginStage(&stages[STAGE_CAPTURE]);
+        if(isScreenSampling) {
+            int isChanged = getSampledLedData(ledData);
+
+            if(frameBudget > 0 && updateQuality(&quality, stages[STAGE_CAPTURE].startTime, getMonotonicTime() - stages[STAGE_CAPTURE].startTime, isChanged)) {
+                applyQualityLevel();
+            }
+        } else {
+            getCalculatedLedData(config, ledData, LED_DATA_LEN, elapsed);
+            recordLatency(&latencies[LATENCY_CAPTURE], getMonotonicTime() - stages[STAGE_CAPTURE].startTime);
+        }
+        endStage(&stages[STAGE_CAPTURE]);
+
+        publishFrame(&capturedFrames);
+    }
+
+    pthread_exit(NULL);
 }
 
 
-void calculateSamplePoints() {
-    // Determine the width and height of a box
-    int samplePointOffset = screenWidth / NUM_LEDS;
+void* computeLoop(void *threadID) {
+    unsigned char *computedLedData;
+    TemporalFilter filter;
+    uint64_t prevFrameTime = 0;
 
-    int curX = 0;
-    for(int i=0; i<NUM_LEDS; i++) {
-        Point *samplePoint = malloc(sizeof(Point));
+    // Do something with threadID to make GCC happy and get rid of the unused parameter warning
+    (void)threadID;
 
-        if(samplePoint == NULL) {
-            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
-            exit(ABNORMAL_EXIT);
+    if((computedLedData = calloc(LED_DATA_LEN, 1)) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+    getLedDataHeader(computedLedData, numLeds);
+    initTemporalFilter(&filter, smoothMode, smoothTime, numLeds * 3);
+
+    if(isScreenSampling && verbose >= VERBOSE) {
+        printf("%s: Smoothing with the %s blend kernel\n", prog, getBlendKernelName());
+    }
+
+    while(1) {
+        unsigned char *capturedLedData = waitForFrame(&capturedFrames);
+        unsigned char *ledData = capturedLedData;
+
+        beginStage(&stages[STAGE_COMPUTE]);
+        if(isScreenSampling) {
+            // Smooth over the time that really passed; frames the capture stage replaced before we got to them count too
+            uint64_t frameTime = stages[STAGE_COMPUTE].startTime;
+            filterFrame(&filter, capturedLedData + 6, computedLedData + 6, (frameTime - prevFrameTime) / 1000000000.0);
+            correctSampledLedData(computedLedData);
+            prevFrameTime = frameTime;
+
+            ledData = computedLedData;
+            recordLatency(&latencies[LATENCY_BLEND], getMonotonicTime() - stages[STAGE_COMPUTE].startTime);
+        }
+
+        // Hand each device its segment of the frame
+        for(int i=0; i<numDevices; i++) {
+            Device *device = &devices[i];
+
+            memcpy(getWriteFrame(&device->frames) + 6, ledData + 6 + device->firstLed * 3, device->numLeds * 3);
+            publishFrame(&device->frames);
+        }
+        endStage(&stages[STAGE_COMPUTE]);
+    }
+
+    pthread_exit(NULL);
+}
+
+
+void* transmitLoop(void *device) {
+    Device *transmitDevice = device;
+
+    while(1) {
+        unsigned char *ledData = waitForFrame(&transmitDevice->frames);
+        size_t ledDataLen = DEVICE_DATA_LEN(transmitDevice);
+        size_t encodedLen = 0;
+
+        // Settings only change between frames
+        const Config *config = acquireConfig(transmitDevice->configReader);
+
+        beginStage(&transmitDevice->stage);
+
+        // Hold back frames the LEDs are already showing, but resend one now and then so the device doesn't time out
+        uint64_t now = transmitDevice->stage.startTime;
+        if(transmitDevice->lastSendTime != 0 && now - transmitDevice->lastSendTime < KEEPALIVE_INTERVAL * 1000000000ULL &&
+           isFrameUnchanged(ledData, transmitDevice->sentData, ledDataLen, config->skipThreshold)) {
+            __atomic_add_fetch(&transmitDevice->skippedFrames, 1, __ATOMIC_RELAXED);
+            endStage(&transmitDevice->stage);
+            continue;
+        }
+
+        if(verbose >= TPL_VERBOSE) {
+            printLedData(ledData, ledDataLen);
         }
 
-        samplePoint->x = curX;
-        samplePoint->y = 0;
+        // Send the encoded frame only if it is smaller
+        if(config->useCompression) {
+            uint64_t startTime = getMonotonicTime();
+            encodedLen = encodeLedData(ledData, ledDataLen, transmitDevice->encodedData);
+            recordLatency(&transmitDevice->latencies[LATENCY_SERIALIZE], getMonotonicTime() - startTime);
+        }
 
-        samplePoints[i] = samplePoint;
+        if(encodedLen > 0) {
+            sendLedDataToDevice(transmitDevice->encodedData, encodedLen, &transmitDevice->writer, transmitDevice->latencies);
+        } else {
+            sendLedDataToDevice(ledData, ledDataLen, &transmitDevice->writer, transmitDevice->latencies);
+        }
 
-        curX += samplePointOffset;
+        memcpy(transmitDevice->sentData, ledData, ledDataLen);
+        transmitDevice->lastSendTime = now;
+        endStage(&transmitDevice->stage);
     }
+
+    pthread_exit(NULL);
+}
+
+
+int isFrameUnchanged(const unsigned char *ledData, const unsigned char *sentData, size_t ledDataLen, int threshold) {
+    if(threshold <= 0) {
+        return threshold == 0 && memcmp(ledData, sentData, ledDataLen) == 0;
+    }
+
+    // Start at position 6, after the LED header/magic word
+    int change = 0;
+    for(size_t i=6; i<ledDataLen; i++) {
+        int channelChange = abs(ledData[i] - sentData[i]);
+        change = (channelChange > change) ? channelChange : change;
+    }
+
+    return change <= threshold;
+}
+
+
+void getLedDataHeader(unsigned char *ledData, int ledCount) {
+    // Define the header of the LED data to be sent to the Arduino each loop iteration
+    ledData[0] = 'A';                            // Magic word
+    ledData[1] = 'd';
+    ledData[2] = 'a';
+    ledData[3] = (ledCount - 1) >> 8;            // LED count high byte
+    ledData[4] = (ledCount - 1) & 0xff;          // LED count low byte
+    ledData[5] = ledData[3] ^ ledData[4] ^ 0x55; // Checksum
 }
 
 
@@ -197,148 +505,344 @@ void calculateGammaTable() {
 }
 
 
-void getCalculatedLedData(unsigned char *ledData, size_t ledDataLen) {
-    static int brightness        = 0;
-    static double shadowPosition = 0;
-    static double lightPosition  = 0;
-    static int hue               = 0;
+void getCalculatedLedData(const Config *config, unsigned char *ledData, size_t ledDataLen, double elapsed) {
+    static unsigned char *brightness = NULL;
+    static int brightnessLen         = 0;
+    static Phase lightPhase          = 0;
+    static int hue                   = 0;
 
-    static unsigned char red;
-    static unsigned char green;
-    static unsigned char blue;
+    int ledCount = (ledDataLen - 6) / 3;
+    FrameState state = {
+        .hue = hue
+    };
 
-    shadowPosition = lightPosition;
+    if(brightnessLen < ledCount) {
+        brightnessLen = ledCount;
+        if((brightness = realloc(brightness, brightnessLen)) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+    }
 
     // Start at position 6, after the LED header/magic word
-    unsigned int i = 6;
-    while(i < ledDataLen) {
-        getLedColor(&red, &green, &blue, hue);
+    effects[config->color].render(&state, elapsed, ledData + 6, ledCount);
+
+    // Resulting hue is multiplied by brightness in the
+    // range of 0 to 255 (0 = off, 255 = brightest).
+    // Gamma corrrection (the cube in the shadow table) adjusts
+    // the brightness to be more perceptually linear.
+    // Each pixel is offset in brightness along the wave.
+    if(config->shadowLength != SDW_NONE || config->rotationSpeed != ROT_NONE) {
+        getShadowBrightness(brightness, ledCount, lightPhase, getShadowStep(config));
+        shadeLedData(ledData + 6, brightness, ledCount);
+    }
 
-        // Resulting hue is multiplied by brightness in the
-        // range of 0 to 255 (0 = off, 255 = brightest).
-        // Gamma corrrection (the 'pow' function here) adjusts
-        // the brightness to be more perceptually linear.
-        brightness = (shadowLength != SDW_NONE || rotationSpeed != ROT_NONE) ? (int)(pow(0.5 + sin(shadowPosition) * 0.5, 3.0) * 255.0) : 255;
+    // Slowly rotate hue and brightness in opposite directions
+    updateHue(config, &hue, elapsed);
+    updateLightPosition(config, &lightPhase, elapsed);
+}
 
-        ledData[i++] = (red   * brightness) / 255;
-        ledData[i++] = (green * brightness) / 255;
-        ledData[i++] = (blue  * brightness) / 255;
 
-        // Each pixel is offset in both hue and brightness
-        updateShadowPosition(&shadowPosition);
+int getSampledLedData(unsigned char *ledData) {
+    // The monitors sampled moved or changed mode; lay the regions out over them again
+    if(hasScreenChanged() && !compileLayout()) {
+        fprintf(stderr, "%s: The layout doesn't fit the screen any more. Leaving the LEDs dark until it does.\n", prog);
     }
 
-    // If color is multi and fade flag was selected, do a slow fade between colors with the rot speed
-    if(fadeSpeed != FADE_NONE && color == MULTI) {
-        switch(fadeSpeed) {
-            case FADE_VERY_SLOW:
-                usleep(1000*180);
-                break;
-            case FADE_SLOW:
-                usleep(1000*130);
-                break;
-            default:
-            case FADE_NORMAL:
-                usleep(1000*90);
-                break;
-            case FADE_FAST:
-                usleep(1000*30);
-                break;
-            case FADE_VERY_FAST:
-                usleep(1000*10);
-                break;
-        }
+    int numRegions;
+    const SampleRegion *regions = getSampleRegions(&numRegions);
+    int numStrips;
+    CaptureStrip *strips = getCaptureStrips(&numStrips);
+
+    uint64_t startTime = getMonotonicTime();
+    captureFrame();
+
+    uint64_t captureTime = getMonotonicTime();
+    recordLatency(&latencies[LATENCY_CAPTURE], captureTime - startTime);
+
+    if(reducer != REDUCER_MODE) {
+        updateStripTables(strips, numStrips);
+    }
+    int isChanged = reduceRegions(regions, numRegions, ledData);
+    if(numRegions == 0) {
+        memset(ledData + 6, 0, numLeds * 3);
     }
 
-    // Slowly rotate hue and brightness in opposite directions
-    updateHue(&hue);
-    updateLightPosition(&lightPosition);
+    recordLatency(&latencies[LATENCY_REDUCE], getMonotonicTime() - captureTime);
+    return isChanged;
 }
 
 
-void getSampledLedData(unsigned char *ledData, unsigned char *prevLedData) {
-    // For the LED data index (j), start at position 6, after the LED header/magic word
-    for(unsigned int i=0, j=NUM_LEDS*3; i<NUM_LEDS && j > 6; i++) {
-        XColor *color = getSamplePointColor(*(samplePoints[i]));
+void startReduceWorkers(int numThreads) {
+    static int isStarted = FALSE;
 
-        blendPrevColors(color, i, prevLedData);
-        correctBrightness(color);
-        //correctGamma(color);
+    if(isStarted) {
+        stopWorkerPool(&reducePool);
+    }
 
-        ledData[--j] = color->red;
-        ledData[--j] = color->green;
-        ledData[--j] = color->blue;
+    startWorkerPool(&reducePool, numThreads);
+    isStarted = TRUE;
 
-        XFree(color);
+    if(verbose >= VERBOSE) {
+        printf("%s: Reducing on %d thread%s\n", prog, reducePool.numWorkers, (reducePool.numWorkers == 1) ? "" : "s");
     }
 }
 
 
-XColor* getSamplePointColor(Point sampleBoxTopRightPoint) {
-    int boxSize = screenWidth / NUM_LEDS;
-    XImage *samplePointImage = getSamplePointImage(sampleBoxTopRightPoint, boxSize, screenHeight);
+int reduceRegions(const SampleRegion *regions, int numRegions, unsigned char *ledData) {
+    static RegionJob job;
+    static int numRegionColors = 0;
 
-    XColor *color = malloc(sizeof(XColor));
-    if(color == NULL) {
-        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
-        exit(ABNORMAL_EXIT);
+    if(numRegionColors < numRegions) {
+        if((job.regionColors = realloc(job.regionColors, numRegions * sizeof(*job.regionColors))) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+        memset(job.regionColors + numRegionColors, 0, (numRegions - numRegionColors) * sizeof(*job.regionColors));
+        numRegionColors = numRegions;
     }
 
-    int *bucketsRed = calloc(255, sizeof(int));
-    int *bucketsGreen = calloc(255, sizeof(int));
-    int *bucketsBlue = calloc(255, sizeof(int));
+    job.regions = regions;
+    job.ledData = ledData;
+    memset(job.workers, 0, sizeof(job.workers));
 
-    for(int i=0; i<boxSize; i++) {
-        for(int j=0; j<screenHeight; j+=10) {
-            unsigned long pixel = XGetPixel(samplePointImage, i, j);
+    // The means are a few lookups each so only the mode is worth handing out to the workers
+    if(reducer == REDUCER_MODE) {
+        runOnPool(&reducePool, reduceRegion, &job, numRegions, 1);
+    } else {
+        for(int i=0; i<numRegions; i++) {
+            reduceRegion(&job, 0, i);
+        }
+    }
 
-            int red = (pixel >> 16) & 0xff;
-            int green = (pixel >> 8)  & 0xff;
-            int blue  = (pixel >> 0)  & 0xff;
+    int isChanged = FALSE;
+    int numReduced = 0;
+    for(int i=0; i<reducePool.numWorkers; i++) {
+        isChanged |= job.workers[i].isChanged;
+        numReduced += job.workers[i].numReduced;
+    }
 
-            bucketsRed[red]++;
-            bucketsGreen[green]++;
-            bucketsBlue[blue]++;
+    if(verbose >= DBL_VERBOSE && numReduced > 0) {
+        printf("Reduced regions");
+        for(int i=0; i<numRegions; i++) {
+            if(isAreaDamaged(regions[i].x, regions[i].y, regions[i].width, regions[i].height)) {
+                printf(" %d", i);
+            }
         }
+        printf("\n");
+    }
+
+    __atomic_add_fetch(&regionsReduced, numReduced, __ATOMIC_RELAXED);
+    return isChanged;
+}
+
+
+static void reduceRegion(void *job, int worker, int item) {
+    RegionJob *regionJob = job;
+    const SampleRegion *region = &regionJob->regions[item];
+    unsigned char *regionColor = regionJob->regionColors[item];
+
+    // Nothing was drawn over the region so the color from the last time still holds.
+    // Regions are in screen order; each one knows which LED it fills. Start at position 6, after the LED header/magic word.
+    if(region->strip == NULL) {
+        // Off the edge of every output sampled
+        memset(regionColor, 0, 3);
+    } else if(isAreaDamaged(region->x, region->y, region->width, region->height)) {
+        XColor color;
+        getRegionColor(region, &color);
+
+        regionJob->workers[worker].isChanged |= (regionColor[0] != color.red || regionColor[1] != color.green || regionColor[2] != color.blue);
+        regionColor[0] = color.red;
+        regionColor[1] = color.green;
+        regionColor[2] = color.blue;
+        regionJob->workers[worker].numReduced++;
     }
 
-    color->red   = getModeOfColor(bucketsRed, 255);
-    color->green = getModeOfColor(bucketsGreen, 255);
-    color->blue  = getModeOfColor(bucketsBlue, 255);
+    memcpy(regionJob->ledData + 6 + region->led * 3, regionColor, 3);
+}
+
 
-    free(bucketsRed);
-    free(bucketsGreen);
-    free(bucketsBlue);
+void applyQualityLevel() {
+    const QualityLevel *level = getQualityLevel(&quality);
+    int scale = (captureScale * level->scale < MAX_CAPTURE_SCALE) ? captureScale * level->scale : MAX_CAPTURE_SCALE;
+
+    if(scale != qualityScale && setCaptureStripScale(scale)) {
+        qualityScale = scale;
+    }
+
+    // The strip tables are kept at the row step they were built with so they have to be built again
+    if(level->rowStep != qualityRowStep) {
+        qualityRowStep = level->rowStep;
+        invalidateCapture();
+    }
+
+    setFrameInterval(&scheduler, getQualityFrameInterval(&quality));
+}
+
+
+void correctSampledLedData(unsigned char *ledData) {
+    // Start at position 6, after the LED header/magic word
+    for(int i=6; i<LED_DATA_LEN; i+=3) {
+        XColor color = {
+            .red   = ledData[i],
+            .green = ledData[i+1],
+            .blue  = ledData[i+2]
+        };
+
+        correctBrightness(&color);
+        //correctGamma(&color);
+
+        ledData[i]   = color.red;
+        ledData[i+1] = color.green;
+        ledData[i+2] = color.blue;
+    }
+}
+
+
+void updateStripTables(CaptureStrip *strips, int numStrips) {
+    static TableBand bands[MAX_CAPTURE_STRIPS * MAX_WORKERS];
+    int numBands = 0;
+
+    for(int i=0; i<numStrips; i++) {
+        CaptureStrip *strip = &strips[i];
+        XImage *image = strip->image;
+
+        // A strip that wasn't captured again still has the same sums
+        if(strip->table != NULL && !isAreaDamaged(strip->x, strip->y, strip->width, strip->height)) {
+            continue;
+        }
+
+        if(strip->table == NULL && (strip->table = calloc(1, sizeof(SummedAreaTable))) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+
+        // One band per worker so that even a single strip is split between all of them
+        prepareSummedAreaTable(strip->table, image->width, image->height, getSampleRowStep(strip->scale), reducePool.numWorkers, reducer == REDUCER_WEIGHTED);
+        for(int j=0; j<strip->table->numBands; j++) {
+            bands[numBands].strip = strip;
+            bands[numBands].band = j;
+            numBands++;
+        }
+    }
 
-    XDestroyImage(samplePointImage);
+    runOnPool(&reducePool, buildTableBand, bands, numBands, 1);
 
-    return color;
+    for(int i=0; i<numBands; i++) {
+        if(bands[i].band == 0) {
+            joinSummedAreaBands(bands[i].strip->table);
+        }
+    }
 }
 
-XImage* getSamplePointImage(Point sampleBoxTopRightPoint, int width, int height) {
-    return XGetImage(XDisplay, RootWindow(XDisplay, DefaultScreen(XDisplay)), sampleBoxTopRightPoint.x, sampleBoxTopRightPoint.y, width, height, AllPlanes, ZPixmap);
+
+static void buildTableBand(void *bands, int worker, int item) {
+    TableBand *tableBand = &((TableBand*)bands)[item];
+    SummedAreaTable *table = tableBand->strip->table;
+    XImage *image = tableBand->strip->image;
+    int rowStep = getSampleRowStep(tableBand->strip->scale);
+    int firstRow = tableBand->band * table->bandRows;
+
+    // Bands don't share anything so it doesn't matter which worker builds them
+    (void)worker;
+
+    if(isDirectPixelFormat(image)) {
+        size_t stride = image->bytes_per_line / sizeof(uint32_t);
+        buildSummedAreaBand(table, tableBand->band, (const uint32_t*)image->data + (size_t)firstRow * rowStep * stride, stride, rowStep);
+        return;
+    }
+
+    // Anything else is converted pixel by pixel first, keeping only the rows of the band that get sampled
+    int numRows = (firstRow + table->bandRows < table->height) ? table->bandRows : table->height - firstRow;
+    const uint32_t *pixels = convertPixels(image, 0, firstRow * rowStep, image->width, numRows, rowStep);
+
+    buildSummedAreaBand(table, tableBand->band, pixels, image->width, 1);
 }
 
 
-int getModeOfColor(int *buckets, size_t numBuckets) {
-    int max = buckets[0];
-    int maxIndex = 0;
+void getRegionColor(const SampleRegion *region, XColor *color) {
+    unsigned char rgb[3];
+
+    // Read the region out of the strip grabbed for this frame. If the strip was shrunk
+    // its pixels are already averages so fewer rows are skipped.
+    XImage *regionImage = region->strip->image;
+    int scale = region->strip->scale;
+    int offsetX = (region->x - region->strip->x) / scale;
+    int offsetY = (region->y - region->strip->y) / scale;
+    int width = getScaledSize(region->x - region->strip->x + region->width, scale) - offsetX;
+    int height = getScaledSize(region->y - region->strip->y + region->height, scale) - offsetY;
+    int rowStep = getSampleRowStep(scale);
+
+    if(reducer != REDUCER_MODE) {
+        // The tables only hold the strip's sampled rows; take the ones inside the region, or the
+        // one just above it if it's too short to have any
+        int firstRow = (offsetY + rowStep - 1) / rowStep;
+        int lastRow = (offsetY + height + rowStep - 1) / rowStep;
+        if(lastRow <= firstRow) {
+            firstRow = offsetY / rowStep;
+            lastRow = firstRow + 1;
+        }
 
-    for(unsigned int i=0; i<numBuckets; i++) {
-        if(buckets[i] > max) {
-            max = buckets[i];
-            maxIndex = i;
+        if(reducer == REDUCER_WEIGHTED) {
+            getAreaWeightedMean(region->strip->table, offsetX, firstRow, width, lastRow - firstRow, rgb);
+        } else {
+            getAreaMean(region->strip->table, offsetX, firstRow, width, lastRow - firstRow, rgb);
         }
+    } else if(isDirectPixelFormat(regionImage)) {
+        // The usual 24 bit visual can be handed to the reducer as is
+        size_t stride = regionImage->bytes_per_line / sizeof(uint32_t);
+        const uint32_t *pixels = (const uint32_t*)regionImage->data + offsetY * stride + offsetX;
+
+        reduceMode(pixels, stride, width, height, rowStep, rgb);
+    } else {
+        // Anything else is converted pixel by pixel first, keeping only the rows that get sampled
+        int numRows = (height + rowStep - 1) / rowStep;
+        const uint32_t *pixels = convertPixels(regionImage, offsetX, offsetY, width, numRows, rowStep);
+
+        reduceMode(pixels, width, width, numRows, 1, rgb);
     }
 
-    return maxIndex;
+    color->red   = rgb[0];
+    color->green = rgb[1];
+    color->blue  = rgb[2];
 }
 
 
-void blendPrevColors(XColor *color, int ledNum, unsigned char *prevLedData) {
-    color->red   = (color->red   * BLEND_WEIGHT + prevLedData[ledNum*3]   * FADE) >> 8;
-    color->green = (color->green * BLEND_WEIGHT + prevLedData[ledNum*3+1] * FADE) >> 8;
-    color->blue  = (color->blue  * BLEND_WEIGHT + prevLedData[ledNum*3+2] * FADE) >> 8;
+int getSampleRowStep(int scale) {
+    // Shrunk strips have fewer rows to skip since each pixel already averages several
+    return (SAMPLE_ROW_STEP * qualityRowStep > scale) ? SAMPLE_ROW_STEP * qualityRowStep / scale : 1;
+}
+
+
+int isDirectPixelFormat(XImage *image) {
+    static const int hostByteOrder = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ? LSBFirst : MSBFirst;
+
+    return image->bits_per_pixel == 32 && image->byte_order == hostByteOrder &&
+           image->red_mask == 0xff0000 && image->green_mask == 0xff00 && image->blue_mask == 0xff;
+}
+
+
+static const uint32_t* convertPixels(XImage *image, int x, int y, int width, int numRows, int rowStep) {
+    // Tables and regions are built on several threads at once, each converting into its own buffer
+    static __thread uint32_t *convertedPixels = NULL;
+    static __thread size_t convertedPixelsLen = 0;
+
+    if(convertedPixelsLen < (size_t)(width * numRows)) {
+        convertedPixelsLen = width * numRows;
+        if((convertedPixels = realloc(convertedPixels, convertedPixelsLen * sizeof(uint32_t))) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+    }
+
+    // Rows rowStep apart starting at y, packed one after the other
+    for(int j=0; j<numRows; j++) {
+        for(int i=0; i<width; i++) {
+            convertedPixels[j * width + i] = XGetPixel(image, x + i, y + j * rowStep) & 0xffffff;
+        }
+    }
+
+    return convertedPixels;
 }
 
 
@@ -378,256 +882,351 @@ void correctGamma(XColor *color) {
 }
 
 
-void getLedColor(unsigned char *r, unsigned char *g, unsigned char *b, int curHue) {
-    static unsigned char _r;
-    static unsigned char _g;
-    static unsigned char _b;
-    static unsigned char lo;
-
-    switch(color) {
-        case MULTI:
-            // Fixed-point hue-to-RGB conversion.  'hue2' is an
-            // integer in the range of 0 to 1535, where 0 = red,
-            // 256 = yellow, 512 = green, etc.  The high byte
-            // (0-5) corresponds to the sextant within the color
-            // wheel, while the low byte (0-255) is the
-            // fractional part between primary/secondary colors.
-            lo = curHue & 255;
-
-            switch((curHue >> 8) % 6) {
-                case 0:
-                    _r = 255;
-                    _g = lo;
-                    _b = 0;
-                    break;
-                case 1:
-                    _r = 255 - lo;
-                    _g = 255;
-                    _b = 0;
-                    break;
-                case 2:
-                    _r = 0;
-                    _g = 255;
-                    _b = lo;
-                    break;
-                case 3:
-                    _r = 0;
-                    _g = 255 - lo;
-                    _b = 255;
-                    break;
-                case 4:
-                    _r = lo;
-                    _g = 0;
-                    _b = 255;
-                    break;
-                case 5:
-                    _r = 255;
-                    _g = 0;
-                    _b = 255 - lo;
-                    break;
-            }
-
-            curHue += 40;
-            break;
-        case RED:
-            _r = 255;
-            _g = 0;
-            _b = 0;
-            break;
-        case ORANGE:
-            _r = 255;
-            _g = 165;
-            _b = 0;
-            break;
-        case YELLOW:
-            _r = 255;
-            _g = 255;
-            _b = 0;
-            break;
-        case GREEN:
-            _r = 0;
-            _g = 255;
-            _b = 0;
-            break;
-        case BLUE:
-            _r = 0;
-            _g = 0;
-            _b = 255;
-            break;
-        case PURPLE:
-            _r = 128;
-            _g = 0;
-            _b = 128;
-            break;
-        case COOL:
-            lo = curHue & 255;
-
-            switch((curHue >> 8) % 6) {
-                case 0:
-                    _r = 0;
-                    _g = lo;
-                    _b = 0;
-                    break;
-                case 1:
-                    _r = 0;
-                    _g = 255;
-                    _b = 0;
-                    break;
-                case 2:
-                    _r = 0;
-                    _g = 255;
-                    _b = lo;
-                    break;
-                case 3:
-                    _r = 0;
-                    _g = 255 - lo;
-                    _b = 255;
-                    break;
-                case 4:
-                    _r = 0;
-                    _g = 0;
-                    _b = 255;
-                    break;
-                case 5:
-                    _r = 0;
-                    _g = 0;
-                    _b = 255 - lo;
-                    break;
-            }
-
-            curHue += 40;
-            break;
-
-        case WHITE:
-        default:
-            _r = 255;
-            _g = 255;
-            _b = 255;
-    }
-
-    *r = _r;
-    *g = _g;
-    *b = _b;
-}
-
+void updateLightPosition(const Config *config, Phase *lightPhase, double elapsed) {
+    double step;
 
-void updateLightPosition(double *lightPosition) {
-    switch(rotationSpeed) {
+    switch(config->rotationSpeed) {
         case ROT_NONE:
-            *lightPosition = 0;
-            break;
+            *lightPhase = 0;
+            return;
         case ROT_VERY_SLOW:
-            *lightPosition += (rotationDir == ROT_CW) ? -.007 : .007;
+            step = .007;
             break;
         case ROT_SLOW:
-            *lightPosition += (rotationDir == ROT_CW) ? -.015 : .015;
+            step = .015;
             break;
         case ROT_NORMAL:
         default:
-            *lightPosition += (rotationDir == ROT_CW) ? -.03 : .03;
+            step = .03;
             break;
         case ROT_FAST:
-            *lightPosition += (rotationDir == ROT_CW) ? -.045 : .045;
+            step = .045;
             break;
         case ROT_VERY_FAST:
-            *lightPosition += (rotationDir == ROT_CW) ? -.07 : .07;
+            step = .07;
             break;
     }
+
+    *lightPhase += radiansToPhase(((config->rotationDir == ROT_CW) ? -step : step) * REFERENCE_FPS * elapsed);
 }
 
 
-void updateShadowPosition(double *shadowPosition) {
-    switch(shadowLength) {
+Phase getShadowStep(const Config *config) {
+    switch(config->shadowLength) {
         case SDW_NONE:
-            *shadowPosition += 0;
-            break;
+            return 0;
         case SDW_VERY_SMALL:
-            *shadowPosition += 0.9;
-            break;
+            return radiansToPhase(0.9);
         case SDW_SMALL:
-            *shadowPosition += 0.6;
-            break;
+            return radiansToPhase(0.6);
         case SDW_NORMAL:
         default:
-            *shadowPosition += 0.3;
-            break;
+            return radiansToPhase(0.3);
         case SDW_LONG:
-            *shadowPosition += 0.2;
-            break;
+            return radiansToPhase(0.2);
         case SDW_VERY_LONG:
-            *shadowPosition += 0.08;
-            break;
+            return radiansToPhase(0.08);
     }
 }
 
 
-void updateHue(int *curHue) {
-    static int hue = 0;
-    *curHue = hue = (hue + 5) % 1536;
+void updateHue(const Config *config, int *curHue, double elapsed) {
+    static double hue = 0;
+    double hueSpeed;
+
+    // If color is multi and fade flag was selected, do a slow fade between colors with the fade speed
+    if(config->fadeSpeed != FADE_NONE && config->color == MULTI) {
+        switch(config->fadeSpeed) {
+            case FADE_VERY_SLOW:
+                hueSpeed = HUE_STEP * 1000 / 180.0;
+                break;
+            case FADE_SLOW:
+                hueSpeed = HUE_STEP * 1000 / 130.0;
+                break;
+            default:
+            case FADE_NORMAL:
+                hueSpeed = HUE_STEP * 1000 / 90.0;
+                break;
+            case FADE_FAST:
+                hueSpeed = HUE_STEP * 1000 / 30.0;
+                break;
+            case FADE_VERY_FAST:
+                hueSpeed = HUE_STEP * 1000 / 10.0;
+                break;
+        }
+    } else {
+        hueSpeed = HUE_STEP * REFERENCE_FPS;
+    }
+
+    hue = fmod(hue + hueSpeed * elapsed, 1536);
+    *curHue = (int)hue;
+}
+
+
+void printLedData(unsigned char *ledData, size_t ledDataLen) {
+    // Print out the contents of the LED data in pretty columns
+    printf("%s: Sending bytes:\n", prog);
+    printf("Magic Word: %c%c%c (%d %d %d)\n", *ledData, *(ledData+1), *(ledData+2), *ledData, *(ledData+1), *(ledData+2));
+    printf("LED count high/low byte: %d,%d\n", *(ledData+3), *(ledData+4));
+    printf("Checksum: %d\n", *(ledData+5));
+    printf("          RED   |  GREEN  |  BLUE\n");
+
+    for(unsigned int i=6; i<ledDataLen; i++) {
+        // Print the LED number every 3 loop iterations
+        if(i%3 == 0) {
+            printf("LED %2d:   ", i/3 - 1);
+        }
+
+        // Print the value in the current index
+        printf("%3d   ", ledData[i]);
+
+        // Print column separators for the first two columns and a newline for the third
+        if((i-2)%3 != 0) {
+            printf("|   ");
+        } else {
+            printf("\n");
+        }
+    }
+    printf("\n\n");
 }
 
 
-void sendLedDataToDevice(unsigned char *ledData, size_t ledDataLen, int deviceDescriptor) {
-    static int frame = 0;
-    static int totalBytesSent = 0;
-    int bytesWritten = 0;
+void sendLedDataToDevice(unsigned char *ledData, size_t ledDataLen, SerialWriter *writer, LatencyHistogram *latencies) {
+    uint64_t startTime = getMonotonicTime();
 
     // Issue color data to LEDs.  Each OS is fussy in different
     // ways about serial output.  This arrangement of drain-and-
     // write-loop seems to be the most relable across platforms:
-    tcdrain(deviceDescriptor);
-    for(int bytesSent = 0, bytesToGo = ledDataLen; bytesToGo > 0;) {
-        // If triple verbose, print out the contents of the LED data in pretty columns
-        if(verbose >= TPL_VERBOSE) {
-            printf("%s: Sending bytes:\n", prog);
-            printf("Magic Word: %c%c%c (%d %d %d)\n", *ledData, *(ledData+1), *(ledData+2), *ledData, *(ledData+1), *(ledData+2));
-            printf("LED count high/low byte: %d,%d\n", *(ledData+3), *(ledData+4));
-            printf("Checksum: %d\n", *(ledData+5));
-            printf("          RED   |  GREEN  |  BLUE\n");
+    drainDevice(writer);
 
-            for(unsigned int i=6; i<ledDataLen; i++) {
-                // Print the LED number every 3 loop iterations
-                if(i%3 == 0) {
-                    printf("LED %2d:   ", i/3 - 1);
-                }
+    uint64_t drainTime = getMonotonicTime();
+    writeToDevice(writer, ledData, ledDataLen);
 
-                // Print the value in the current index
-                printf("%3d   ", ledData[i]);
+    recordLatency(&latencies[LATENCY_DRAIN], drainTime - startTime);
+    recordLatency(&latencies[LATENCY_WRITE], getMonotonicTime() - drainTime);
+}
 
-                // Print column separators for the first two columns and a newline for the third
-                if((i-2)%3 != 0) {
-                    printf("|   ");
-                } else {
-                    printf("\n");
-                }
-            }
-            printf("\n\n");
+
+void printStatistics() {
+    static uint64_t prevReportTime = 0;
+    uint64_t now = getMonotonicTime();
+    double elapsed = (now - prevReportTime) / 1000000000.0;
+
+    // Rates are over the time since the last report rather than since startup so stalls show up
+    for(int i=0; i<numDevices; i++) {
+        SerialWriter *writer = &devices[i].writer;
+        uint64_t framesWritten = getFramesWritten(writer);
+        uint64_t bytesWritten = getBytesWritten(writer);
+        uint64_t skippedFrames = __atomic_load_n(&devices[i].skippedFrames, __ATOMIC_RELAXED);
+
+        if(prevReportTime != 0) {
+            printf("%s: Frames/sec: %.1f, bytes/sec: %.0f, unchanged/sec: %.1f, write stalls: %lu, device queue: %d bytes\n", writer->device,
+                (framesWritten - devices[i].reportedFrames) / elapsed, (bytesWritten - devices[i].reportedBytes) / elapsed,
+                (skippedFrames - devices[i].reportedSkipped) / elapsed, (unsigned long)getWriteStalls(writer), getQueueDepth(writer));
         }
 
-        if((bytesWritten = write(deviceDescriptor, &ledData[bytesSent], bytesToGo)) > 0) {
-            bytesToGo -= bytesWritten;
-            bytesSent += bytesWritten;
+        devices[i].reportedFrames = framesWritten;
+        devices[i].reportedBytes = bytesWritten;
+        devices[i].reportedSkipped = skippedFrames;
+    }
+
+    if(isScreenSampling) {
+        static uint64_t reportedRegions = 0;
+        static uint64_t reportedCaptures = 0;
+        uint64_t regions = __atomic_load_n(&regionsReduced, __ATOMIC_RELAXED);
+        uint64_t captures = getLatencyTotal(&latencies[LATENCY_CAPTURE]);
+
+        printf("X requests/frame: %lu, regions reduced/frame: %.1f\n", getCaptureRequests(),
+            (captures > reportedCaptures) ? (double)(regions - reportedRegions) / (captures - reportedCaptures) : 0.0);
+
+        reportedRegions = regions;
+        reportedCaptures = captures;
+    }
+
+    if(isScreenSampling && frameBudget > 0) {
+        static uint64_t reportedMisses = 0;
+        const QualityLevel *level = getQualityLevel(&quality);
+        uint64_t budgetMisses = __atomic_load_n(&quality.budgetMisses, __ATOMIC_RELAXED);
+
+        if(prevReportTime != 0) {
+            printf("Quality level: %d/%d (scale %d, row step %d, capturing 1 in %d frames%s), budget misses/sec: %.1f\n",
+                __atomic_load_n(&quality.level, __ATOMIC_RELAXED), getNumQualityLevels() - 1, level->scale, level->rowStep,
+                getQualityFrameInterval(&quality), __atomic_load_n(&quality.isStatic, __ATOMIC_RELAXED) ? ", static" : "",
+                (budgetMisses - reportedMisses) / elapsed);
         }
+
+        reportedMisses = budgetMisses;
     }
 
-    // Keep track of byte and frame counts for statistics
-    totalBytesSent += sizeof(ledData);
-    frame++;
+    printStageOccupancy();
+    printFrameJitter();
+    prevReportTime = now;
+}
+
 
-    // Update statistics once per second
-    if(verbose >= VERBOSE && (curTime = time(NULL)) != prevTime) {
-        printf("Average frames/sec: %d, bytes/sec: %d\n", (int)((float)frame / (float)(curTime - startTime)), (int)((float)totalBytesSent / (float)(curTime - startTime)));
-        prevTime = curTime;
+void printStageOccupancy() {
+    static uint64_t prevReportTime = 0;
+    uint64_t now = getMonotonicTime();
+    uint64_t elapsed = now - prevReportTime;
+
+    // The first report has nothing to compare against
+    if(prevReportTime == 0) {
+        for(int i=0; i<NUM_STAGES; i++) {
+            getStageOccupancy(&stages[i], elapsed);
+        }
+        for(int i=0; i<numDevices; i++) {
+            getStageOccupancy(&devices[i].stage, elapsed);
+        }
+        prevReportTime = now;
+        return;
+    }
+
+    printf("Stage occupancy:");
+    for(int i=0; i<NUM_STAGES; i++) {
+        printf(" %s %d%%", stages[i].name, getStageOccupancy(&stages[i], elapsed));
+    }
+    for(int i=0; i<numDevices; i++) {
+        printf(" %s %d%%", devices[i].stage.name, getStageOccupancy(&devices[i].stage, elapsed));
+    }
+    printf("\n");
+
+    prevReportTime = now;
+}
+
+
+void printFrameJitter() {
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t droppedFrames;
+
+    getFrameJitter(&scheduler, &p50, &p99, &droppedFrames);
+
+    // Nothing to show until the scheduler has seen a full window of frames
+    if(p50 != 0) {
+        printf("Frame interval p50: %.2fms, p99: %.2fms, dropped frames: %lu\n", p50 / 1000000.0, p99 / 1000000.0, (unsigned long)droppedFrames);
+    }
+}
+
+
+void printLatencies() {
+    uint64_t p50;
+    uint64_t p95;
+    uint64_t p99;
+    uint64_t max;
+
+    for(int i=0; i<NUM_LATENCIES; i++) {
+        rollLatencyWindow(&latencies[i]);
+    }
+    for(int i=0; i<numDevices; i++) {
+        for(int j=0; j<NUM_DEVICE_LATENCIES; j++) {
+            rollLatencyWindow(&devices[i].latencies[j]);
+        }
+    }
+
+    printf("Latency over the last %ds (p50 / p95 / p99 / max ms):\n", LATENCY_WINDOW);
+
+    // Stages that don't run in the current mode have nothing to show
+    for(int i=0; i<NUM_LATENCIES; i++) {
+        if(getLatencySamples(&latencies[i]) > 0) {
+            getLatencyPercentiles(&latencies[i], &p50, &p95, &p99, &max);
+            printf("  %-24s %8.3f / %8.3f / %8.3f / %8.3f\n", latencies[i].name, p50 / 1000000.0, p95 / 1000000.0, p99 / 1000000.0, max / 1000000.0);
+        }
+    }
+
+    for(int i=0; i<numDevices; i++) {
+        for(int j=0; j<NUM_DEVICE_LATENCIES; j++) {
+            LatencyHistogram *histogram = &devices[i].latencies[j];
+            char name[64];
+
+            if(getLatencySamples(histogram) > 0) {
+                snprintf(name, sizeof(name), "%s %s", devices[i].writer.device, histogram->name);
+                getLatencyPercentiles(histogram, &p50, &p95, &p99, &max);
+                printf("  %-24s %8.3f / %8.3f / %8.3f / %8.3f\n", name, p50 / 1000000.0, p95 / 1000000.0, p99 / 1000000.0, max / 1000000.0);
+            }
+        }
+    }
+}
+
+
+void writeStatsSnapshot(FILE *out) {
+    static const char *speedNames[] = {"none", "very_slow", "slow", "normal", "fast", "very_fast"};
+    static const char *shadowNames[] = {"none", "very_small", "small", "normal", "long", "very_long"};
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t droppedFrames;
+    const Config *config = acquireConfig(CONFIG_READER_STATS);
+
+    getFrameJitter(&scheduler, &p50, &p99, &droppedFrames);
+
+    fprintf(out, "# HELP colorswirl_info Active settings.\n# TYPE colorswirl_info gauge\n");
+    fprintf(out, "colorswirl_info{version=\"%s\",mode=\"%s\",color=\"%s\",rotation=\"%s\",direction=\"%s\",shadow=\"%s\",fade=\"%s\"} 1\n",
+        VERSION, isScreenSampling ? "sample" : "calculated", effects[config->color].name, speedNames[config->rotationSpeed],
+        config->rotationDir == ROT_CW ? "cw" : "ccw", shadowNames[config->shadowLength], speedNames[config->fadeSpeed]);
+
+    fprintf(out, "# HELP colorswirl_leds LEDs on the strip.\n# TYPE colorswirl_leds gauge\n");
+    fprintf(out, "colorswirl_leds %d\n", numLeds);
+    fprintf(out, "# HELP colorswirl_target_fps Target frame rate; 0 for as fast as possible.\n# TYPE colorswirl_target_fps gauge\n");
+    fprintf(out, "colorswirl_target_fps %d\n", config->fps);
+
+    fprintf(out, "# HELP colorswirl_frames_captured_total Frames captured or calculated.\n# TYPE colorswirl_frames_captured_total counter\n");
+    fprintf(out, "colorswirl_frames_captured_total %lu\n", (unsigned long)getLatencyTotal(&latencies[LATENCY_CAPTURE]));
+    if(isScreenSampling) {
+        fprintf(out, "# HELP colorswirl_regions_reduced_total Sample regions reduced; regions nothing was drawn over are skipped.\n# TYPE colorswirl_regions_reduced_total counter\n");
+        fprintf(out, "colorswirl_regions_reduced_total %lu\n", (unsigned long)__atomic_load_n(&regionsReduced, __ATOMIC_RELAXED));
+    }
+    if(isScreenSampling && frameBudget > 0) {
+        fprintf(out, "# HELP colorswirl_quality_level Sampling quality level; 0 is full quality, higher is cheaper.\n# TYPE colorswirl_quality_level gauge\n");
+        fprintf(out, "colorswirl_quality_level %d\n", __atomic_load_n(&quality.level, __ATOMIC_RELAXED));
+        fprintf(out, "# HELP colorswirl_capture_interval Target frames per frame captured.\n# TYPE colorswirl_capture_interval gauge\n");
+        fprintf(out, "colorswirl_capture_interval %d\n", getQualityFrameInterval(&quality));
+        fprintf(out, "# HELP colorswirl_budget_misses_total Captures that took longer than the frame budget.\n# TYPE colorswirl_budget_misses_total counter\n");
+        fprintf(out, "colorswirl_budget_misses_total %lu\n", (unsigned long)__atomic_load_n(&quality.budgetMisses, __ATOMIC_RELAXED));
+    }
+    fprintf(out, "# HELP colorswirl_frames_dropped_total Frame deadlines skipped because a frame ran late.\n# TYPE colorswirl_frames_dropped_total counter\n");
+    fprintf(out, "colorswirl_frames_dropped_total %lu\n", (unsigned long)droppedFrames);
+
+    fprintf(out, "# HELP colorswirl_stage_busy_seconds_total Time each pipeline stage spent working.\n# TYPE colorswirl_stage_busy_seconds_total counter\n");
+    for(int i=0; i<NUM_STAGES; i++) {
+        fprintf(out, "colorswirl_stage_busy_seconds_total{stage=\"%s\"} %.6f\n", stages[i].name, getStageBusyTime(&stages[i]) / 1000000000.0);
+    }
+    for(int i=0; i<numDevices; i++) {
+        fprintf(out, "colorswirl_stage_busy_seconds_total{stage=\"transmit\",device=\"%s\"} %.6f\n", devices[i].writer.device, getStageBusyTime(&devices[i].stage) / 1000000000.0);
+    }
+
+    fprintf(out, "# HELP colorswirl_frames_sent_total Frames written to the device.\n# TYPE colorswirl_frames_sent_total counter\n");
+    for(int i=0; i<numDevices; i++) {
+        fprintf(out, "colorswirl_frames_sent_total{device=\"%s\"} %lu\n", devices[i].writer.device, (unsigned long)getFramesWritten(&devices[i].writer));
+    }
+    fprintf(out, "# HELP colorswirl_frames_unchanged_total Frames not sent because the LEDs were already showing them.\n# TYPE colorswirl_frames_unchanged_total counter\n");
+    for(int i=0; i<numDevices; i++) {
+        fprintf(out, "colorswirl_frames_unchanged_total{device=\"%s\"} %lu\n", devices[i].writer.device, (unsigned long)__atomic_load_n(&devices[i].skippedFrames, __ATOMIC_RELAXED));
+    }
+    fprintf(out, "# HELP colorswirl_bytes_sent_total Bytes written to the device.\n# TYPE colorswirl_bytes_sent_total counter\n");
+    for(int i=0; i<numDevices; i++) {
+        fprintf(out, "colorswirl_bytes_sent_total{device=\"%s\"} %lu\n", devices[i].writer.device, (unsigned long)getBytesWritten(&devices[i].writer));
+    }
+    fprintf(out, "# HELP colorswirl_write_stalls_total Writes that found the device output queue full (EAGAIN).\n# TYPE colorswirl_write_stalls_total counter\n");
+    for(int i=0; i<numDevices; i++) {
+        fprintf(out, "colorswirl_write_stalls_total{device=\"%s\"} %lu\n", devices[i].writer.device, (unsigned long)getWriteStalls(&devices[i].writer));
+    }
+    fprintf(out, "# HELP colorswirl_device_queue_bytes Bytes left in the device output queue after the last write.\n# TYPE colorswirl_device_queue_bytes gauge\n");
+    for(int i=0; i<numDevices; i++) {
+        fprintf(out, "colorswirl_device_queue_bytes{device=\"%s\"} %d\n", devices[i].writer.device, getQueueDepth(&devices[i].writer));
     }
 }
 
 
-int processArgs(int argc, char **argv, char **device) {
+int processArgs(int argc, char **argv, char ***devices, int *numDevices, Config *config) {
+    static char *defaultDevices[] = {DEFAULT_DEVICE};
+
     char c;                   // Char for processing command line args
     int optIndex;             // Index of long opts for processing command line args
+    int effect;               // Index of the effect named by the color option
+    int numNames;             // Outputs named by the output option
 
-    // In order to call getopt() more than once, optind must be reset to 1
-    optind = 1;
+    // In order to call getopt() more than once, optind must be reset. Resetting it to 0 rather than 1 also
+    // makes glibc forget where it was in the previous argv, which the next message may have overwritten.
+    optind = 0;
 
     // Valid long options
     static struct option longOpts[] = {
@@ -638,6 +1237,23 @@ int processArgs(int argc, char **argv, char **device) {
         {"fade",     optional_argument, NULL, 'f'},
         {"solid",    optional_argument, NULL, 'o'},
         {"sample",   no_argument,       NULL, 'm'},
+        {"leds",     required_argument, NULL, 'l'},
+        {"fps",      required_argument, NULL, 'p'},
+        {"no-shm",   no_argument,       NULL, 'N'},
+        {"no-damage",no_argument,       NULL, 'G'},
+        {"reducer",  required_argument, NULL, 'R'},
+        {"smooth",   required_argument, NULL, 't'},
+        {"smooth-time",required_argument, NULL, 'T'},
+        {"downscale",required_argument, NULL, 'D'},
+        {"budget",   required_argument, NULL, 'B'},
+        {"threads",  required_argument, NULL, 'j'},
+        {"compress", no_argument,       NULL, 'z'},
+        {"skip",     required_argument, NULL, 'k'},
+        {"stats",    no_argument,       NULL, 'S'},
+        {"socket",   required_argument, NULL, 'u'},
+        {"layout",   required_argument, NULL, 'L'},
+        {"output",   required_argument, NULL, 'O'},
+        {"input",    required_argument, NULL, 'i'},
         {"no-fork",  no_argument,       NULL, 'F'},
         {"verbose",  no_argument,       NULL, 'v'},
         {"version",  no_argument,       NULL, 'V'},
@@ -646,32 +1262,24 @@ int processArgs(int argc, char **argv, char **device) {
     };
 
     // Parse the command line args
-    while((c = getopt_long(argc, argv, "c:r:d:s:f::o::mFhvVp:", longOpts, &optIndex)) != -1) {
+    while((c = getopt_long(argc, argv, "c:r:d:s:f::o::l:L:O:i:mNGR:t:T:D:B:j:zk:Su:FhvVp:", longOpts, &optIndex)) != -1) {
         switch (c) {
             // Color
             case 'c':
-                if     (strcmp(optarg, "multi")  == 0) color = MULTI;
-                else if(strcmp(optarg, "red")    == 0) color = RED;
-                else if(strcmp(optarg, "orange") == 0) color = ORANGE;
-                else if(strcmp(optarg, "yellow") == 0) color = YELLOW;
-                else if(strcmp(optarg, "green")  == 0) color = GREEN;
-                else if(strcmp(optarg, "blue")   == 0) color = BLUE;
-                else if(strcmp(optarg, "purple") == 0) color = PURPLE;
-                else if(strcmp(optarg, "white")  == 0) color = WHITE;
-                else if(strcmp(optarg, "cool")   == 0) color = COOL;
-                else {
+                if((effect = findEffect(optarg)) == -1) {
                     printUsage(prog);
                     return -1;
                 }
+                config->color = effect;
                 break;
             // Rotation speed
             case 'r':
-                if     (strcmp(optarg, "none")      == 0 || strcmp(optarg, "n")  == 0) rotationSpeed = ROT_NONE;
-                else if(strcmp(optarg, "very_slow") == 0 || strcmp(optarg, "vs") == 0) rotationSpeed = ROT_VERY_SLOW;
-                else if(strcmp(optarg, "slow")      == 0 || strcmp(optarg, "s")  == 0) rotationSpeed = ROT_SLOW;
-                else if(strcmp(optarg, "normal")    == 0)                              rotationSpeed = ROT_NORMAL;
-                else if(strcmp(optarg, "fast")      == 0 || strcmp(optarg, "f")  == 0) rotationSpeed = ROT_FAST;
-                else if(strcmp(optarg, "very_fast") == 0 || strcmp(optarg, "vf") == 0) rotationSpeed = ROT_VERY_FAST;
+                if     (strcmp(optarg, "none")      == 0 || strcmp(optarg, "n")  == 0) config->rotationSpeed = ROT_NONE;
+                else if(strcmp(optarg, "very_slow") == 0 || strcmp(optarg, "vs") == 0) config->rotationSpeed = ROT_VERY_SLOW;
+                else if(strcmp(optarg, "slow")      == 0 || strcmp(optarg, "s")  == 0) config->rotationSpeed = ROT_SLOW;
+                else if(strcmp(optarg, "normal")    == 0)                              config->rotationSpeed = ROT_NORMAL;
+                else if(strcmp(optarg, "fast")      == 0 || strcmp(optarg, "f")  == 0) config->rotationSpeed = ROT_FAST;
+                else if(strcmp(optarg, "very_fast") == 0 || strcmp(optarg, "vf") == 0) config->rotationSpeed = ROT_VERY_FAST;
                 else {
                     printUsage(prog);
                     return -1;
@@ -679,8 +1287,8 @@ int processArgs(int argc, char **argv, char **device) {
                 break;
             // Rotation direction
             case 'd':
-                if     (strcmp(optarg, "cw")  == 0) rotationDir = ROT_CW;
-                else if(strcmp(optarg, "ccw") == 0) rotationDir = ROT_CCW;
+                if     (strcmp(optarg, "cw")  == 0) config->rotationDir = ROT_CW;
+                else if(strcmp(optarg, "ccw") == 0) config->rotationDir = ROT_CCW;
                 else {
                     printUsage(prog);
                     return -1;
@@ -688,12 +1296,12 @@ int processArgs(int argc, char **argv, char **device) {
                 break;
             // Shadow length
             case 's':
-                if     (strcmp(optarg, "none")       == 0 || strcmp(optarg, "n")  == 0) shadowLength = SDW_NONE;
-                else if(strcmp(optarg, "very_small") == 0 || strcmp(optarg, "vs") == 0) shadowLength = SDW_VERY_SMALL;
-                else if(strcmp(optarg, "small")      == 0 || strcmp(optarg, "s")  == 0) shadowLength = SDW_SMALL;
-                else if(strcmp(optarg, "normal")     == 0)                              shadowLength = SDW_NORMAL;
-                else if(strcmp(optarg, "long")       == 0 || strcmp(optarg, "l")  == 0) shadowLength = SDW_LONG;
-                else if(strcmp(optarg, "very_long")  == 0 || strcmp(optarg, "vl") == 0) shadowLength = SDW_VERY_LONG;
+                if     (strcmp(optarg, "none")       == 0 || strcmp(optarg, "n")  == 0) config->shadowLength = SDW_NONE;
+                else if(strcmp(optarg, "very_small") == 0 || strcmp(optarg, "vs") == 0) config->shadowLength = SDW_VERY_SMALL;
+                else if(strcmp(optarg, "small")      == 0 || strcmp(optarg, "s")  == 0) config->shadowLength = SDW_SMALL;
+                else if(strcmp(optarg, "normal")     == 0)                              config->shadowLength = SDW_NORMAL;
+                else if(strcmp(optarg, "long")       == 0 || strcmp(optarg, "l")  == 0) config->shadowLength = SDW_LONG;
+                else if(strcmp(optarg, "very_long")  == 0 || strcmp(optarg, "vl") == 0) config->shadowLength = SDW_VERY_LONG;
                 else {
                     printUsage(prog);
                     return -1;
@@ -701,50 +1309,262 @@ int processArgs(int argc, char **argv, char **device) {
                 break;
             // Fade
             case 'f':
-                if     (optarg == NULL || strcmp(optarg, "slow") == 0 || strcmp(optarg, "s") == 0) rotationSpeed = ROT_SLOW;
-                else if(strcmp(optarg, "very_slow") == 0 || strcmp(optarg, "vs") == 0) rotationSpeed = ROT_VERY_SLOW;
-                else if(strcmp(optarg, "normal")    == 0 || strcmp(optarg, "n")  == 0) rotationSpeed = ROT_NORMAL;
-                else if(strcmp(optarg, "fast")      == 0 || strcmp(optarg, "f")  == 0) rotationSpeed = ROT_FAST;
-                else if(strcmp(optarg, "very_fast") == 0 || strcmp(optarg, "vf") == 0) rotationSpeed = ROT_VERY_FAST;
+                if     (optarg == NULL || strcmp(optarg, "slow") == 0 || strcmp(optarg, "s") == 0) config->rotationSpeed = ROT_SLOW;
+                else if(strcmp(optarg, "very_slow") == 0 || strcmp(optarg, "vs") == 0) config->rotationSpeed = ROT_VERY_SLOW;
+                else if(strcmp(optarg, "normal")    == 0 || strcmp(optarg, "n")  == 0) config->rotationSpeed = ROT_NORMAL;
+                else if(strcmp(optarg, "fast")      == 0 || strcmp(optarg, "f")  == 0) config->rotationSpeed = ROT_FAST;
+                else if(strcmp(optarg, "very_fast") == 0 || strcmp(optarg, "vf") == 0) config->rotationSpeed = ROT_VERY_FAST;
                 else {
                     printUsage(prog);
                     return -1;
                 }
-                shadowLength = SDW_NONE;
+                config->shadowLength = SDW_NONE;
                 break;
             // Solid
             case 'o':
-                if     (optarg == NULL || strcmp(optarg, "slow") == 0 || strcmp(optarg, "s") == 0) fadeSpeed = FADE_SLOW;
-                else if(strcmp(optarg, "very_slow") == 0 || strcmp(optarg, "vs") == 0) fadeSpeed = FADE_VERY_SLOW;
-                else if(strcmp(optarg, "normal")    == 0 || strcmp(optarg, "n")  == 0) fadeSpeed = FADE_NORMAL;
-                else if(strcmp(optarg, "fast")      == 0 || strcmp(optarg, "f")  == 0) fadeSpeed = FADE_FAST;
-                else if(strcmp(optarg, "very_fast") == 0 || strcmp(optarg, "vf") == 0) fadeSpeed = FADE_VERY_FAST;
+                if     (optarg == NULL || strcmp(optarg, "slow") == 0 || strcmp(optarg, "s") == 0) config->fadeSpeed = FADE_SLOW;
+                else if(strcmp(optarg, "very_slow") == 0 || strcmp(optarg, "vs") == 0) config->fadeSpeed = FADE_VERY_SLOW;
+                else if(strcmp(optarg, "normal")    == 0 || strcmp(optarg, "n")  == 0) config->fadeSpeed = FADE_NORMAL;
+                else if(strcmp(optarg, "fast")      == 0 || strcmp(optarg, "f")  == 0) config->fadeSpeed = FADE_FAST;
+                else if(strcmp(optarg, "very_fast") == 0 || strcmp(optarg, "vf") == 0) config->fadeSpeed = FADE_VERY_FAST;
                 else {
                     printUsage(prog);
                     return -1;
                 }
-                rotationSpeed = ROT_NONE;
-                shadowLength = SDW_NONE;
+                config->rotationSpeed = ROT_NONE;
+                config->shadowLength = SDW_NONE;
                 break;
             // Screen sampling
             case 'm':
+                // The capture stage is set up for one mode or the other at startup
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: Screen sampling can't be turned on while running. Ignoring.\n", prog);
+                    break;
+                }
+
                 isScreenSampling = 1;
                 fprintf(stderr, "%s: WARNING: Screen sampling does not work very well. Feel free to improve it and submit a pull request. :)\n", prog);
                 break;
+            // Number of LEDs
+            case 'l':
+                // Frame buffers are sized at startup so the count can't be changed by an update message
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The LED count can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                if(sscanf(optarg, "%d", &numLeds) != 1 || numLeds < 1 || numLeds > MAX_NUM_LEDS) {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // LED layout for screen sampling
+            case 'L':
+                // The layout decides the LED count so like it, it can't be changed by an update message
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The layout can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                layoutFile = optarg;
+                break;
+            // Video stream to sample
+            case 'i':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The input can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                inputSpec = optarg;
+                break;
+            // Monitors to sample
+            case 'O':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The outputs sampled can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                numNames = 1;
+                for(char *name=optarg; *name != '\0'; name++) {
+                    numNames += (*name == ',');
+                }
+
+                if(optarg[0] == '\0' || strstr(optarg, ",,") != NULL || optarg[strlen(optarg) - 1] == ',' || numNames > MAX_OUTPUTS || strlen(optarg) >= MAX_MSG_LEN) {
+                    printUsage(prog);
+                    return -1;
+                }
+
+                outputNames = optarg;
+                break;
+            // Target frame rate
+            case 'p':
+                if(sscanf(optarg, "%d", &config->fps) != 1 || config->fps < 0) {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Capture with XGetImage even if MIT-SHM is available
+            case 'N':
+                // The capture strips pick their path when they're set up
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The capture path can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                useShm = 0;
+                break;
+            // Capture and reduce every region each frame even if XDamage is available
+            case 'G':
+                // Damage tracking is set up with the X connection at startup
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: Damage tracking can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                useDamage = 0;
+                break;
+            // Region reducer
+            case 'R':
+                // The strip tables are built for the reducer chosen at startup
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The reducer can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                if     (strcmp(optarg, "mean")     == 0) reducer = REDUCER_MEAN;
+                else if(strcmp(optarg, "weighted") == 0) reducer = REDUCER_WEIGHTED;
+                else if(strcmp(optarg, "mode")     == 0) reducer = REDUCER_MODE;
+                else {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Smoothing of sampled colors
+            case 't':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The smoothing can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                if     (strcmp(optarg, "none")     == 0 || strcmp(optarg, "n") == 0) smoothMode = SMOOTH_NONE;
+                else if(strcmp(optarg, "exp")      == 0 || strcmp(optarg, "e") == 0) smoothMode = SMOOTH_EXP;
+                else if(strcmp(optarg, "adaptive") == 0 || strcmp(optarg, "a") == 0) smoothMode = SMOOTH_ADAPTIVE;
+                else if(strcmp(optarg, "cut")      == 0 || strcmp(optarg, "c") == 0) smoothMode = SMOOTH_SCENE_CUT;
+                else {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Smoothing time constant
+            case 'T':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The smoothing can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                if(sscanf(optarg, "%d", &smoothTime) != 1 || smoothTime < 0) {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Shrink captures on the X server
+            case 'D':
+                // Capture strips are set up at startup so the scale can't be changed by an update message
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The capture scale can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                if(sscanf(optarg, "%d", &captureScale) != 1 || captureScale < 1 || captureScale > MAX_CAPTURE_SCALE) {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Capture time budget
+            case 'B':
+                // The controller is set up with the X connection at startup
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The frame budget can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                if(sscanf(optarg, "%lf", &frameBudget) != 1 || frameBudget < 0) {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Reduction threads
+            case 'j':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The thread count can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                if(sscanf(optarg, "%d", &numWorkers) != 1 || numWorkers < 1 || numWorkers > MAX_WORKERS) {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Send run-length encoded frames
+            case 'z':
+                config->useCompression = 1;
+                break;
+            // Hold back frames that barely changed
+            case 'k':
+                if(sscanf(optarg, "%d", &config->skipThreshold) != 1 || config->skipThreshold < -1 || config->skipThreshold > 255) {
+                    printUsage(prog);
+                    return -1;
+                }
+                break;
+            // Print stage latencies
+            case 'S':
+                config->showStats = 1;
+                break;
+            // Serve statistics on a Unix socket
+            case 'u':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The stats socket can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
+                statsSocket = optarg;
+                break;
             // No fork
             case 'F':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: Already running. Ignoring --no-fork.\n", prog);
+                    break;
+                }
+
                 noFork = 1;
                 break;
             // Print help
             case 'h':
+                // Exiting on a message would take the LEDs down with it
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: Already running. Ignoring --help.\n", prog);
+                    break;
+                }
+
                 printUsage(prog);
                 exit(NORMAL_EXIT);
             // Print version
             case 'V':
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: Already running. Ignoring --version.\n", prog);
+                    break;
+                }
+
                 printVersion(prog);
                 exit(NORMAL_EXIT);
             // Set verbosity level
             case 'v':
+                // Every thread reads the level as it goes
+                if(devices == NULL) {
+                    fprintf(stderr, "%s: The verbosity can't be changed while running. Ignoring.\n", prog);
+                    break;
+                }
+
                 verbose++;
                 break;
             case '?':
@@ -754,17 +1574,19 @@ int processArgs(int argc, char **argv, char **device) {
         }
     }
 
-    // Get the device we're using (if device is NULL don't worry about it; this happens if updating from a message)
-    if(argc == optind+1 && device != NULL) {
-        *device = argv[optind];
+    // Get the devices we're using (if devices is NULL don't worry about it; this happens if updating from a message)
+    if(argc > optind && devices != NULL) {
+        *devices = &argv[optind];
+        *numDevices = argc - optind;
     } else if(argc > optind) {
         fprintf(stderr, "%s: Too many arguments specified.\n", prog);
         printUsage(prog);
         return -1;
-    } else if(device != NULL) {
+    } else if(devices != NULL) {
         // If a device wasn't specified, try a common one
         printf("%s: Device not specified. Defaulting to \"%s\".\n", prog, DEFAULT_DEVICE);
-        *device = DEFAULT_DEVICE;
+        *devices = defaultDevices;
+        *numDevices = 1;
     }
 
     return 0;
@@ -793,24 +1615,26 @@ void* messageLoop(void *threadID) {
         pthread_exit(NULL);
     }
 
+    // Queue attributes
+    if(mq_getattr(mqd, &attr) == -1) {
+        fprintf(stderr, "Error getting message queue attributes: %s. Exiting message queue thread.\n", strerror(errno));
+        pthread_exit(NULL);
+    }
+
+    // The buffers are sized once for the queue's max message size and reused for every message
+    size_t maxArgs = attr.mq_msgsize / 2 + 1;
+    char *message = malloc(attr.mq_msgsize + 1);
+    char **argv = malloc(maxArgs * sizeof(char*));
+    if(message == NULL || argv == NULL) {
+        fprintf(stderr, "Failed to allocate memory for message queue buffer. Exiting message queue thread.\n");
+        pthread_exit(NULL);
+    }
+
     if(verbose >= DBL_VERBOSE) {
         printf("%s: Connected to message queue. Waiting for messages...\n", prog);
     }
 
     while(1) {
-        // Queue attributes
-        if(mq_getattr(mqd, &attr) == -1) {
-            fprintf(stderr, "Error getting message queue attributes: %s. Exiting message queue thread.\n", strerror(errno));
-            pthread_exit(NULL);
-        }
-
-        // Create the buffer for the queue message from the max message size of the queue
-        char *message = malloc(attr.mq_msgsize);
-        if(message == NULL) {
-            fprintf(stderr, "Failed to allocate memory for message queue buffer. Exiting message queue thread.\n");
-            pthread_exit(NULL);
-        }
-
         // Get the first message which is the argument count
         if((msgLen = mq_receive(mqd, message, attr.mq_msgsize, 0)) == -1) {
             fprintf(stderr, "Failed to recieve message in queue: %s\n", strerror(errno));
@@ -836,26 +1660,36 @@ void* messageLoop(void *threadID) {
             fprintf(stderr, "%s: Got message (should be %d arguments): %s\n", prog, argc, message);
         }
 
-        // Tokenize the buffer back to an array
-        char **argv = malloc(attr.mq_msgsize);
-        char *arg = strtok(message, " ");
-        int i = 0;
-        while(arg != NULL) {
-            argv[i] = arg;
-            arg = strtok(NULL, " ");
-            i++;
-        }
+        processMessageArgs(argc, message, argv, maxArgs);
+    }
+
+    pthread_exit(NULL);
+}
 
-        // Pass on the new argumentsto the process args function to update the global behavior variables
-        processArgs(argc, argv, NULL);
 
-        free(argv);
-        free(message);
-        argv = NULL;
-        message = NULL;
+int processMessageArgs(int argc, char *message, char **argv, size_t maxArgs) {
+    // Tokenize the buffer back to an array
+    char *arg = strtok(message, " ");
+    int i = 0;
+    while(arg != NULL && (size_t)i < maxArgs) {
+        argv[i] = arg;
+        arg = strtok(NULL, " ");
+        i++;
     }
 
-    pthread_exit(NULL);
+    if(argc > i) {
+        argc = i;
+    }
+
+    // Pass on the new arguments to the process args function and publish the updated
+    // settings all at once. A bad message leaves the settings as they were.
+    Config *config = editConfig();
+    if(processArgs(argc, argv, NULL, NULL, config) == -1) {
+        return -1;
+    }
+
+    publishConfig(config);
+    return 0;
 }
 
 
@@ -870,6 +1704,7 @@ void sigHandler(int sig) {
         printf("%s: Deleting message queue\n", prog);
     }
     mq_unlink(MQ_NAME);
+    stopStatsServer();
 
     exit(0);
 }
@@ -19,6 +19,7 @@ arrangement for your specific configuration.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -36,7 +37,13 @@ arrangement for your specific configuration.
 #include <getopt.h>
 
 
-#define NUM_LEDS 25
+#define DEFAULT_NUM_LEDS 25
+#define MAX_NUM_LEDS     65536 // The LED count is sent to the device as 16 bits
+
+// LED data sent to a device is a 6 byte header + 3 bytes per LED
+#define LED_DATA_LEN            (6 + (numLeds * 3))
+#define DEVICE_DATA_LEN(device) (6 + ((device)->numLeds * 3))
+#define KEEPALIVE_INTERVAL 5 // Seconds an unchanged frame is held back for; the coupled sketch blanks the LEDs after 15
 
 #define NORMAL_EXIT   0
 #define ABNORMAL_EXIT 1
@@ -89,67 +96,115 @@ arrangement for your specific configuration.
 #define SDW_LONG       4
 #define SDW_VERY_LONG  5
 
+// Pipeline stages
+#define STAGE_CAPTURE 0
+#define STAGE_COMPUTE 1
+#define NUM_STAGES    2 // Each device also has its own transmit stage
+
+// Latency histograms
+#define LATENCY_CAPTURE      0
+#define LATENCY_REDUCE       1
+#define LATENCY_BLEND        2
+#define NUM_LATENCIES        3 // Each device also has its own histograms below
+#define LATENCY_SERIALIZE    0
+#define LATENCY_DRAIN        1
+#define LATENCY_WRITE        2
+#define NUM_DEVICE_LATENCIES 3
+
+// Animation steps are given per frame at the rate the animations were originally
+// tuned at (a 25 LED frame at 115200 baud) and scaled by the time actually elapsed
+#define REFERENCE_FPS 140
+#define HUE_STEP      5
+
 // Sample options
-#define MIN_BRIGHTNESS 200
-#define FADE           75
-#define BLEND_WEIGHT   (257 - FADE)
+#define SAMPLE_ROW_STEP 10
+#define REDUCER_MEAN     0 // Region reducers
+#define REDUCER_WEIGHTED 1
+#define REDUCER_MODE     2
+#define MIN_BRIGHTNESS  200
 
 
+// Animation settings; published as a whole to the threads using them, see config.c
 typedef struct {
-    int x;
-    int y;
-} Point;
-
-
-char *prog;                    // Name of the program
-int verbose;                   // Verbosity level
-int screenWidth;               // Width of the screen
-int screenHeight;              // Height of the screen
-Point *samplePoints[NUM_LEDS]; // Pixel locations of the edges of each sample box
-Display *XDisplay;             // Connection to X11
-char gammaCorrection[256][3];  // Gamma correction table for sampled RGB values
-
-int noFork;           // Flag for not forking on startup
-int isScreenSampling; // Flag for sampling screen colors for LED color data
-int color;            // Selected color
-int rotationSpeed;    // Selected rotation speed
-int rotationDir;      // Selected rotation direction
-int shadowLength;     // Selected shadow length
-int fadeSpeed;        // If the solid flag was selected
-
-time_t curTime;   // The current time
-time_t startTime; // Time of program start
-time_t prevTime;  // Previous current time
-
-
-int processArgs(int argc, char **argv, char **device);
+    int color;          // Selected color
+    int rotationSpeed;  // Selected rotation speed
+    int rotationDir;    // Selected rotation direction
+    int shadowLength;   // Selected shadow length
+    int fadeSpeed;      // If the solid flag was selected
+    int useCompression; // Flag for sending run-length encoded frames
+    int skipThreshold;  // Largest change in any channel a frame can have and still not be sent; -1 sends every frame
+    int fps;            // Target frame rate; 0 for as fast as possible
+    int showStats;      // Flag for printing stage latency percentiles
+} Config;
+
+struct SerialWriter;
+struct LatencyHistogram;
+struct SampleRegion;
+struct CaptureStrip;
+
+
+extern char *prog;                    // Name of the program
+extern int verbose;                   // Verbosity level
+extern int screenWidth;               // Width of the screen
+extern int screenHeight;              // Height of the screen
+extern int numLeds;                   // Number of LEDs on the strip
+extern Display *XDisplay;             // Connection to X11
+extern char gammaCorrection[256][3];  // Gamma correction table for sampled RGB values
+
+extern int noFork;           // Flag for not forking on startup
+extern int isScreenSampling; // Flag for sampling screen colors for LED color data
+extern int useShm;           // Flag for capturing the screen through the MIT-SHM extension
+extern int useDamage;        // Flag for only capturing and reducing the parts of the screen that changed
+extern int reducer;          // How sample regions are reduced to one color
+extern int smoothMode;       // How sampled colors are smoothed over time
+extern int smoothTime;       // Time constant of the smoothing in ms
+extern double frameBudget;   // ms of capture time per frame the quality controller aims for; 0 for no controller
+extern int numWorkers;       // Threads sampled frames are reduced on
+extern int captureScale;     // Factor the X server shrinks captures by before they are fetched; 1 for none
+extern char *statsSocket;    // Path of the Unix socket statistics are served on; NULL for none
+extern char *layoutFile;     // Path of the file placing the LEDs around the screen; NULL for the default
+extern char *inputSpec;      // Video stream sampled instead of the screen, see video.c; NULL for the screen
+extern char *outputNames;    // Comma separated XRandR outputs the LEDs are placed around; NULL for the whole root window
+
+
+int processArgs(int argc, char **argv, char ***devices, int *numDevices, Config *config);
+int processMessageArgs(int argc, char *message, char **argv, size_t maxArgs);
 void* messageLoop(void*);
 void startMessageThread(pthread_t *threadID);
-
-int openDevice(char *device);
-void getLedDataHeader(unsigned char *ledData);
-void sendLedDataToDevice(unsigned char *ledData, size_t ledDataLen, int deviceDescriptor);
-void updatePrevLedData(unsigned char *ledData, unsigned char *prevLedData, int ledDataLen);
-
-void getCalculatedLedData(unsigned char *ledData, size_t ledDataLen);
-void getSampledLedData(unsigned char *ledData, unsigned char *prevLedData);
-void getLedColor(unsigned char *r, unsigned char *g, unsigned char *b, int curHue);
-
-void openXDisplay();
-void getScreenResolution();
-void calculateSamplePoints();
-XColor* getSamplePointColor(Point sampleBoxTopRightPoint);
-XImage* getSamplePointImage(Point sampleBoxTopRightPoint, int width, int height);
-int getModeOfColor(int *buckets, size_t numBuckets);
+void* captureLoop(void *threadID);
+void* computeLoop(void *threadID);
+void* transmitLoop(void *device);
+void printStatistics();
+void printStageOccupancy();
+void printFrameJitter();
+void printLatencies();
+void writeStatsSnapshot(FILE *out);
+
+void openDevices(char **deviceSpecs, int numDeviceSpecs);
+void getLedDataHeader(unsigned char *ledData, int ledCount);
+void printLedData(unsigned char *ledData, size_t ledDataLen);
+int isFrameUnchanged(const unsigned char *ledData, const unsigned char *sentData, size_t ledDataLen, int threshold);
+void sendLedDataToDevice(unsigned char *ledData, size_t ledDataLen, struct SerialWriter *writer, struct LatencyHistogram *latencies);
+
+void getCalculatedLedData(const Config *config, unsigned char *ledData, size_t ledDataLen, double elapsed);
+int getSampledLedData(unsigned char *ledData);
+void applyQualityLevel();
+void correctSampledLedData(unsigned char *ledData);
+
+void startReduceWorkers(int numThreads);
+int reduceRegions(const struct SampleRegion *regions, int numRegions, unsigned char *ledData);
+void updateStripTables(struct CaptureStrip *strips, int numStrips);
+void getRegionColor(const struct SampleRegion *region, XColor *color);
+int getSampleRowStep(int scale);
+int isDirectPixelFormat(XImage *image);
 
 void calculateGammaTable();
-void blendPrevColors(XColor *color, int ledNum, unsigned char *prevLedData);
 void correctBrightness(XColor *color);
 void correctGamma(XColor *color);
 
-void updateLightPosition(double *lightPosition);
-void updateShadowPosition(double *shadowPosition);
-void updateHue(int *curHue);
+void updateLightPosition(const Config *config, uint32_t *lightPhase, double elapsed);
+uint32_t getShadowStep(const Config *config);
+void updateHue(const Config *config, int *curHue, double elapsed);
 
 void sigHandler(int sig);
 int installSigHandler(int sig, sighandler_t func);
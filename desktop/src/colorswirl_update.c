@@ -54,35 +54,32 @@ int main(int argc, char **argv) {
         fprintf(stderr, "%s: Error opening queue: %s\n", argv[0], strerror(errno));
         return 1;
     }
-    // Convert argc to a string and send it
-    char _argc[2];
-    snprintf(_argc, 2, "%d", argc);
-
-    // Send the number of arguments
-    if(mq_send(mqd, _argc, 2, 1) == -1) {
-        fprintf(stderr, "%s: Failed to send argument count: %s\n", argv[0], strerror(errno));
-        return 1;
-    }
 
     // Flatten the argv array
     size_t argv_len = 0;
-    char *argv_flat = malloc(MAX_MSG_LEN);
-    for(int i=0; i<argc; i++) {
-        strncat(argv_flat, argv[i], argv_len += strlen(argv[i]));
-
-        // Add the space between arguments if not last argument
-        if(i != argc-1) {
-            strncat(argv_flat, " ", 1);
-            argv_len++;
-        }
+    char argv_flat[MAX_MSG_LEN + 1] = "";
+    for(int i=0; i<argc && argv_len < MAX_MSG_LEN; i++) {
+        // Add the space between arguments if not first argument
+        argv_len += snprintf(argv_flat + argv_len, sizeof(argv_flat) - argv_len, "%s%s", (i != 0) ? " " : "", argv[i]);
     }
 
     // Check the argument string doesn't exceed the max length
-    if(argv_len>= MAX_MSG_LEN) {
+    if(argv_len >= MAX_MSG_LEN) {
         fprintf(stderr, "%s: Arguments exceeds max length limit of %d\n", argv[0], MAX_MSG_LEN);
         return 1;
     }
 
+    // Convert argc to a string and send it
+    char _argc[12];
+    snprintf(_argc, sizeof(_argc), "%d", argc);
+
+    // Send the number of arguments. Both messages go at the same priority so that
+    // updates sent back to back are received in order.
+    if(mq_send(mqd, _argc, strlen(_argc), 0) == -1) {
+        fprintf(stderr, "%s: Failed to send argument count: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
     // Send the arguments
     if(mq_send(mqd, argv_flat, argv_len, 0) == -1) {
         fprintf(stderr, "%s: Failed to send arguments: %s\n", argv[0], strerror(errno));
@@ -92,9 +89,5 @@ int main(int argc, char **argv) {
     // Close the queue
     mq_close(mqd);
 
-    // Clean up
-    free(argv_flat);
-    argv_flat = NULL;
-
     return 0;
 }
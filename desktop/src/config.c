@@ -0,0 +1,87 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Publishing the animation settings from the message thread to the threads that use
+ * them. An update is made in a private copy of the current settings and published with
+ * one atomic pointer store, so a reader sees either all of an update or none of it.
+ *
+ * Copies live in a set of slots allocated up front so an update allocates nothing.
+ * There are enough that one is always free: one published, one per reader and one
+ * being edited. Each reader announces the slot it is using (a hazard pointer) and
+ * the message thread only ever edits a slot that is neither published nor announced.
+ * Readers acquire once per frame and keep using that slot until their next acquire.
+ *
+ * Only the message thread may call editConfig() and publishConfig().
+ *
+ */
+
+#include "colorswirl.h"
+#include "config.h"
+
+static Config *slots;
+static int numSlots;
+static Config *published;
+static Config **hazards;  // Slot each reader is using, NULL if none
+static int numReaders;
+
+
+void initConfig(const Config *config, int readers) {
+    numReaders = readers;
+    numSlots = readers + 2;
+
+    if((slots = calloc(numSlots, sizeof(Config))) == NULL || (hazards = calloc(numReaders, sizeof(Config*))) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    slots[0] = *config;
+    __atomic_store_n(&published, &slots[0], __ATOMIC_SEQ_CST);
+}
+
+
+Config* editConfig() {
+    Config *current = __atomic_load_n(&published, __ATOMIC_SEQ_CST);
+
+    for(int i=0; i<numSlots; i++) {
+        Config *slot = &slots[i];
+        int isFree = (slot != current);
+
+        for(int j=0; j<numReaders && isFree; j++) {
+            isFree = (__atomic_load_n(&hazards[j], __ATOMIC_SEQ_CST) != slot);
+        }
+
+        if(isFree) {
+            *slot = *current;
+            return slot;
+        }
+    }
+
+    // Can't happen with a slot for every reader plus two
+    fprintf(stderr, "%s: No free configuration slot.\n", prog);
+    exit(ABNORMAL_EXIT);
+}
+
+
+void publishConfig(Config *config) {
+    __atomic_store_n(&published, config, __ATOMIC_SEQ_CST);
+}
+
+
+const Config* acquireConfig(int reader) {
+    Config *config;
+
+    // Announce the slot, then make sure it wasn't replaced (and possibly handed out
+    // for editing) before the announcement was visible
+    do {
+        config = __atomic_load_n(&published, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&hazards[reader], config, __ATOMIC_SEQ_CST);
+    } while(config != __atomic_load_n(&published, __ATOMIC_SEQ_CST));
+
+    return config;
+}
@@ -0,0 +1,22 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+// Threads that read the published configuration; each holds on to at most one slot
+#define CONFIG_READER_RENDER   0
+#define CONFIG_READER_STATS    1
+#define CONFIG_READER_MAIN     2
+#define CONFIG_READER_TRANSMIT 3 // First of one reader per device
+#define NUM_CONFIG_READERS(numDevices) (CONFIG_READER_TRANSMIT + (numDevices))
+
+void initConfig(const Config *config, int numReaders);
+Config* editConfig();
+void publishConfig(Config *config);
+const Config* acquireConfig(int reader);
@@ -0,0 +1,149 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * The colors of the calculated modes. Each effect renders a whole frame at once, so
+ * anything it depends on is looked at once per frame rather than once per LED and a
+ * new effect is just another entry in the table.
+ *
+ * The color wheel effects walk the wheel HUE_OFFSET steps per LED. The wheel is
+ * converted to RGB once at startup; cool is the same wheel without the red channel.
+ *
+ */
+
+#include <string.h>
+
+#include "colorswirl.h"
+#include "effect.h"
+
+static unsigned char hueWheel[HUE_RANGE][3];
+
+static void renderMulti(const FrameState *state, double elapsed, unsigned char *restrict ledData, int len);
+static void renderCool(const FrameState *state, double elapsed, unsigned char *restrict ledData, int len);
+
+// Solid colors don't change between LEDs or frames
+#define SOLID_EFFECT(effect, red, green, blue) \
+    static void effect(const FrameState *state, double elapsed, unsigned char *restrict ledData, int len) { \
+        (void)state; \
+        (void)elapsed; \
+        for(int i=0; i<len; i++) { \
+            ledData[i*3]   = (red); \
+            ledData[i*3+1] = (green); \
+            ledData[i*3+2] = (blue); \
+        } \
+    }
+
+SOLID_EFFECT(renderRed,    255, 0,   0)
+SOLID_EFFECT(renderOrange, 255, 165, 0)
+SOLID_EFFECT(renderYellow, 255, 255, 0)
+SOLID_EFFECT(renderGreen,  0,   255, 0)
+SOLID_EFFECT(renderBlue,   0,   0,   255)
+SOLID_EFFECT(renderPurple, 128, 0,   128)
+SOLID_EFFECT(renderWhite,  255, 255, 255)
+
+const Effect effects[NUM_EFFECTS] = {
+    [MULTI]  = {"multi",  renderMulti},
+    [RED]    = {"red",    renderRed},
+    [ORANGE] = {"orange", renderOrange},
+    [YELLOW] = {"yellow", renderYellow},
+    [GREEN]  = {"green",  renderGreen},
+    [BLUE]   = {"blue",   renderBlue},
+    [PURPLE] = {"purple", renderPurple},
+    [WHITE]  = {"white",  renderWhite},
+    [COOL]   = {"cool",   renderCool}
+};
+
+
+void initEffects() {
+    for(int hue=0; hue<HUE_RANGE; hue++) {
+        // Fixed-point hue-to-RGB conversion. 'hue' is an
+        // integer in the range of 0 to 1535, where 0 = red,
+        // 256 = yellow, 512 = green, etc. The high byte
+        // (0-5) corresponds to the sextant within the color
+        // wheel, while the low byte (0-255) is the
+        // fractional part between primary/secondary colors.
+        unsigned char lo = hue & 255;
+        unsigned char *rgb = hueWheel[hue];
+
+        switch(hue >> 8) {
+            case 0:
+                rgb[0] = 255;
+                rgb[1] = lo;
+                rgb[2] = 0;
+                break;
+            case 1:
+                rgb[0] = 255 - lo;
+                rgb[1] = 255;
+                rgb[2] = 0;
+                break;
+            case 2:
+                rgb[0] = 0;
+                rgb[1] = 255;
+                rgb[2] = lo;
+                break;
+            case 3:
+                rgb[0] = 0;
+                rgb[1] = 255 - lo;
+                rgb[2] = 255;
+                break;
+            case 4:
+                rgb[0] = lo;
+                rgb[1] = 0;
+                rgb[2] = 255;
+                break;
+            case 5:
+                rgb[0] = 255;
+                rgb[1] = 0;
+                rgb[2] = 255 - lo;
+                break;
+        }
+    }
+}
+
+
+int findEffect(const char *name) {
+    for(int i=0; i<NUM_EFFECTS; i++) {
+        if(strcmp(name, effects[i].name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static void renderMulti(const FrameState *state, double elapsed, unsigned char *restrict ledData, int len) {
+    (void)elapsed;
+
+    for(int i=0, hue=state->hue; i<len; i++) {
+        ledData[i*3]   = hueWheel[hue][0];
+        ledData[i*3+1] = hueWheel[hue][1];
+        ledData[i*3+2] = hueWheel[hue][2];
+
+        hue += HUE_OFFSET;
+        if(hue >= HUE_RANGE) {
+            hue -= HUE_RANGE;
+        }
+    }
+}
+
+
+static void renderCool(const FrameState *state, double elapsed, unsigned char *restrict ledData, int len) {
+    (void)elapsed;
+
+    for(int i=0, hue=state->hue; i<len; i++) {
+        ledData[i*3]   = 0;
+        ledData[i*3+1] = hueWheel[hue][1];
+        ledData[i*3+2] = hueWheel[hue][2];
+
+        hue += HUE_OFFSET;
+        if(hue >= HUE_RANGE) {
+            hue -= HUE_RANGE;
+        }
+    }
+}
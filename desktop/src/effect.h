@@ -0,0 +1,31 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#define NUM_EFFECTS 9   // One per color option; effects are indexed by the color constants
+#define HUE_RANGE   1536 // Hues are fixed-point positions on the color wheel, 256 per sextant
+#define HUE_OFFSET  40   // Hue difference between neighboring LEDs
+
+typedef struct {
+    int hue; // Position on the color wheel of the first LED
+} FrameState;
+
+// Renders a whole frame of colors into ledData, 3 bytes per LED
+typedef void (*EffectRender)(const FrameState *state, double elapsed, unsigned char *restrict ledData, int len);
+
+typedef struct {
+    const char *name;
+    EffectRender render;
+} Effect;
+
+extern const Effect effects[NUM_EFFECTS];
+
+void initEffects();
+int findEffect(const char *name);
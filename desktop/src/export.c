@@ -0,0 +1,100 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Serves the statistics on a Unix domain socket for monitoring, since stdout is gone
+ * once the daemon forks. Every connection is sent one snapshot in the Prometheus text
+ * format and closed, so "socat - UNIX-CONNECT:path" or a node exporter textfile job
+ * can scrape it.
+ *
+ * The server has a thread to itself and the snapshot only loads counters the other
+ * threads update atomically, so a slow or stuck client never holds up a frame.
+ *
+ */
+
+#include "colorswirl.h"
+#include "export.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char *socketPath = NULL;
+static int serverFd = -1;
+static SnapshotWriter snapshotWriter;
+
+static void* statsServerLoop(void *threadID);
+
+
+void startStatsServer(const char *path, SnapshotWriter writeSnapshot) {
+    pthread_t threadID;
+    struct sockaddr_un address = {
+        .sun_family = AF_UNIX
+    };
+
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: Stats socket path \"%s\" is too long.\n", prog, path);
+        exit(ABNORMAL_EXIT);
+    }
+    strcpy(address.sun_path, path);
+
+    // A socket left behind by a previous run would make bind() fail
+    unlink(path);
+
+    if((serverFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 || bind(serverFd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(serverFd, 8) == -1) {
+        fprintf(stderr, "%s: Error opening stats socket \"%s\": %s\n", prog, path, strerror(errno));
+        exit(ABNORMAL_EXIT);
+    }
+
+    socketPath = path;
+    snapshotWriter = writeSnapshot;
+
+    // Clients that hang up early must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_create(&threadID, NULL, statsServerLoop, NULL);
+}
+
+
+void stopStatsServer() {
+    if(socketPath != NULL) {
+        unlink(socketPath);
+    }
+}
+
+
+static void* statsServerLoop(void *threadID) {
+    // Do something with threadID to make GCC happy and get rid of the unused parameter warning
+    (void)threadID;
+
+    while(1) {
+        int clientFd;
+        FILE *client;
+
+        if((clientFd = accept4(serverFd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+            if(errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "%s: Error accepting stats client: %s\n", prog, strerror(errno));
+                sleep(1);
+            }
+            continue;
+        }
+
+        // Give up on clients that stop reading so the next one still gets served
+        struct timeval timeout = {.tv_sec = 1};
+        setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        if((client = fdopen(clientFd, "w")) == NULL) {
+            close(clientFd);
+            continue;
+        }
+
+        snapshotWriter(client);
+        fclose(client);
+    }
+
+    pthread_exit(NULL);
+}
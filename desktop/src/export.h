@@ -0,0 +1,18 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stdio.h>
+
+// Writes a snapshot of the statistics to a connected client
+typedef void (*SnapshotWriter)(FILE *out);
+
+void startStatsServer(const char *path, SnapshotWriter writeSnapshot);
+void stopStatsServer();
@@ -0,0 +1,184 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Temporal smoothing of the sampled colors. Each channel of each LED is a one-pole
+ * low-pass filter whose time constant is given in milliseconds. The share of the
+ * distance to the new value covered in a frame, 1 - exp(-elapsed / time constant), is
+ * worked out from the real time since the previous frame. The lights therefore
+ * settle at the same speed whatever the frame rate is.
+ *
+ * The filter state is kept in its own buffer, one 8.8 fixed point value per channel,
+ * so small steps at long time constants aren't rounded away. The blend itself is
+ * integer only. Each step rounds away from the old value, so a channel always reaches
+ * its target and never overshoots it. The SSE2 kernel blends eight channels at a time
+ * and must match the scalar kernel exactly.
+ *
+ * The adaptive mode shortens the time constant for large changes, so noise is
+ * smoothed out while a window being moved is followed closely. The scene cut mode
+ * jumps straight to a frame whose colors changed by more than SCENE_CUT_THRESHOLD on
+ * average.
+ *
+ */
+
+#include "colorswirl.h"
+#include "filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define MAX_ALPHA 65535
+
+static BlendKernel blendKernel = blendFrameScalar; // Kernel selected for the running CPU
+static const char *blendKernelName = "scalar";
+
+static uint16_t getAlpha(double elapsed, double timeConstant);
+
+
+void initTemporalFilter(TemporalFilter *filter, int mode, int timeConstant, int len) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("sse2")) {
+        blendKernel = blendFrameSse2;
+        blendKernelName = "sse2";
+    }
+#endif
+
+    filter->mode = mode;
+    filter->timeConstant = timeConstant / 1000.0;
+    filter->len = len;
+    filter->isPrimed = FALSE;
+
+    if((filter->state = calloc(len, sizeof(uint16_t))) == NULL || (filter->alphas = calloc(len, sizeof(uint16_t))) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+}
+
+
+const char* getBlendKernelName() {
+    return blendKernelName;
+}
+
+
+void filterFrame(TemporalFilter *filter, const unsigned char *in, unsigned char *out, double elapsed) {
+    int len = filter->len;
+
+    // Start from the first frame rather than fading in from black
+    if(filter->mode == SMOOTH_NONE || !filter->isPrimed) {
+        for(int i=0; i<len; i++) {
+            filter->state[i] = in[i] << 8;
+        }
+        memcpy(out, in, len);
+        filter->isPrimed = TRUE;
+        return;
+    }
+
+    uint16_t alpha = getAlpha(elapsed, filter->timeConstant);
+
+    if(filter->mode == SMOOTH_ADAPTIVE) {
+        for(int i=0; i<256; i++) {
+            filter->adaptiveAlphas[i] = getAlpha(elapsed, filter->timeConstant * ADAPTIVE_KNEE / (ADAPTIVE_KNEE + i));
+        }
+
+        // Each LED moves at the speed set by its channel that changed most
+        for(int i=0; i+3<=len; i+=3) {
+            int change = 0;
+            for(int j=i; j<i+3; j++) {
+                int channelChange = abs(in[j] - ((filter->state[j] + 128) >> 8));
+                change = (channelChange > change) ? channelChange : change;
+            }
+
+            filter->alphas[i] = filter->alphas[i+1] = filter->alphas[i+2] = filter->adaptiveAlphas[change];
+        }
+    } else {
+        if(filter->mode == SMOOTH_SCENE_CUT) {
+            int change = 0;
+            for(int i=0; i<len; i++) {
+                change += abs(in[i] - ((filter->state[i] + 128) >> 8));
+            }
+
+            if(change > len * SCENE_CUT_THRESHOLD) {
+                alpha = MAX_ALPHA;
+            }
+        }
+
+        for(int i=0; i<len; i++) {
+            filter->alphas[i] = alpha;
+        }
+    }
+
+    blendKernel(filter->state, filter->alphas, in, out, len);
+}
+
+
+static uint16_t getAlpha(double elapsed, double timeConstant) {
+    if(timeConstant <= 0) {
+        return MAX_ALPHA;
+    }
+
+    double alpha = (1 - exp(-elapsed / timeConstant)) * 65536 + 0.5;
+    return (alpha > MAX_ALPHA) ? MAX_ALPHA : (alpha < 0) ? 0 : (uint16_t)alpha;
+}
+
+
+void blendFrameScalar(uint16_t *state, const uint16_t *alphas, const unsigned char *in, unsigned char *out, int len) {
+    for(int i=0; i<len; i++) {
+        uint32_t target = in[i] << 8;
+        uint32_t value = state[i];
+
+        // ceil(distance * alpha / 65536) so any step at all moves the value by at least one
+        if(target >= value) {
+            value += ((target - value) * alphas[i] + 65535) >> 16;
+        } else {
+            value -= ((value - target) * alphas[i] + 65535) >> 16;
+        }
+
+        state[i] = value;
+        out[i] = (value + 128) >> 8;
+    }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static inline __m128i getBlendStep(__m128i distance, __m128i alpha) {
+    // The high half of the product, plus one if the low half isn't zero, is the product rounded up
+    __m128i high = _mm_mulhi_epu16(distance, alpha);
+    __m128i isExact = _mm_cmpeq_epi16(_mm_mullo_epi16(distance, alpha), _mm_setzero_si128());
+
+    return _mm_sub_epi16(high, _mm_andnot_si128(isExact, _mm_set1_epi16(-1)));
+}
+
+
+__attribute__((target("sse2")))
+void blendFrameSse2(uint16_t *state, const uint16_t *alphas, const unsigned char *in, unsigned char *out, int len) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    int i = 0;
+
+    for(; i+8<=len; i+=8) {
+        // Interleaving with zeros below the input bytes gives the targets in 8.8 fixed point
+        __m128i target = _mm_unpacklo_epi8(zero, _mm_loadl_epi64((const __m128i*)&in[i]));
+        __m128i value = _mm_loadu_si128((const __m128i*)&state[i]);
+        __m128i alpha = _mm_loadu_si128((const __m128i*)&alphas[i]);
+
+        // The distance doesn't fit a signed lane so each direction is handled separately; one of them is always zero
+        __m128i up = _mm_subs_epu16(target, value);
+        __m128i down = _mm_subs_epu16(value, target);
+        value = _mm_sub_epi16(_mm_add_epi16(value, getBlendStep(up, alpha)), getBlendStep(down, alpha));
+
+        _mm_storeu_si128((__m128i*)&state[i], value);
+        _mm_storel_epi64((__m128i*)&out[i], _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(value, half), 8), zero));
+    }
+
+    blendFrameScalar(state + i, alphas + i, in + i, out + i, len - i);
+}
+#endif
@@ -0,0 +1,43 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stdint.h>
+
+// Smoothing modes
+#define SMOOTH_NONE      0
+#define SMOOTH_EXP       1 // One-pole exponential
+#define SMOOTH_ADAPTIVE  2 // Exponential that follows large changes faster than small ones
+#define SMOOTH_SCENE_CUT 3 // Exponential that jumps straight to a frame that changed completely
+
+#define DEFAULT_SMOOTH_TIME  14 // ms; what the old fixed per-frame blend came to at the default frame rate
+#define ADAPTIVE_KNEE        16 // Change in a channel that halves the time constant in the adaptive mode
+#define SCENE_CUT_THRESHOLD  48 // Mean change per channel that counts as a scene cut
+
+// Pointers are to the LED colors only, without the header
+typedef void (*BlendKernel)(uint16_t *state, const uint16_t *alphas, const unsigned char *in, unsigned char *out, int len);
+
+typedef struct {
+    int mode;
+    double timeConstant; // Seconds
+    int len;             // Channel values per frame (3 per LED)
+    uint16_t *state;     // Filtered channel values in 8.8 fixed point
+    uint16_t *alphas;    // Share of the distance to the new value covered this frame, per channel value, in 0.16 fixed point
+    uint16_t adaptiveAlphas[256]; // Alpha for each size of change in the adaptive mode
+    int isPrimed;        // Flag for the state holding a frame
+} TemporalFilter;
+
+void initTemporalFilter(TemporalFilter *filter, int mode, int timeConstant, int len);
+void filterFrame(TemporalFilter *filter, const unsigned char *in, unsigned char *out, double elapsed);
+const char* getBlendKernelName();
+void blendFrameScalar(uint16_t *state, const uint16_t *alphas, const unsigned char *in, unsigned char *out, int len);
+#if defined(__x86_64__) || defined(__i386__)
+void blendFrameSse2(uint16_t *state, const uint16_t *alphas, const unsigned char *in, unsigned char *out, int len);
+#endif
@@ -0,0 +1,242 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Summed-area tables for the mean reducers. One pass over a capture strip sums every
+ * pixel above and to the left of each point. After that, the sum over any rectangle
+ * takes four lookups, so the mean of a region costs the same whatever its size and
+ * however many regions overlap it.
+ *
+ * The sums are allowed to wrap. Rectangle sums are differences of the table entries
+ * and unsigned arithmetic is modular, so a rectangle comes out right as long as its
+ * own sum fits: up to 16 million pixels for the plain sums.
+ *
+ * The weighted mean weighs each pixel by its chroma (the spread between its largest
+ * and smallest channel) plus one. Saturated content then outweighs the greys, whites
+ * and blacks of window decorations and letterboxing, while an all grey region still
+ * comes out as its plain mean.
+ *
+ * To build a table on several threads, its rows are split into bands that each start
+ * from zero as if they were the top of the table. Once all bands are built, each band's
+ * offset row is worked out, which is one row of additions per band. A lookup then adds
+ * the offset of the band its row is in. The sums are exact integers whichever way they
+ * are split, so the means come out the same for any number of bands.
+ *
+ */
+
+#include "colorswirl.h"
+#include "integral.h"
+
+static void* growTableArray(void *array, size_t size, size_t entrySize);
+static size_t getBandEntry(const SummedAreaTable *table, int row, int x);
+
+
+void prepareSummedAreaTable(SummedAreaTable *table, int width, int height, int rowStep, int numBands, int isWeighted) {
+    int numRows = (height + rowStep - 1) / rowStep;
+    size_t tableStride = width + 1;
+    size_t size = tableStride * (numRows + 1);
+
+    // Bands of at least one row each
+    table->bandRows = (numRows + numBands - 1) / ((numBands > 0) ? numBands : 1);
+    table->bandRows = (table->bandRows > 0) ? table->bandRows : 1;
+    table->numBands = (numRows + table->bandRows - 1) / table->bandRows;
+    table->numBands = (table->numBands > 0) ? table->numBands : 1;
+
+    size_t offsetsSize = tableStride * table->numBands;
+
+    // Only ever grows; a strip keeps the same size from frame to frame
+    if(table->size < size || (isWeighted && !table->isWeighted)) {
+        table->sums = growTableArray(table->sums, size, sizeof(*table->sums));
+        if(isWeighted) {
+            table->weights = growTableArray(table->weights, size, sizeof(*table->weights));
+            table->weightedSums = growTableArray(table->weightedSums, size, sizeof(*table->weightedSums));
+        }
+        table->size = size;
+    }
+
+    if(table->offsetsSize < offsetsSize || (isWeighted && !table->isWeighted)) {
+        table->sumOffsets = growTableArray(table->sumOffsets, offsetsSize, sizeof(*table->sumOffsets));
+        if(isWeighted) {
+            table->weightOffsets = growTableArray(table->weightOffsets, offsetsSize, sizeof(*table->weightOffsets));
+            table->weightedOffsets = growTableArray(table->weightedOffsets, offsetsSize, sizeof(*table->weightedOffsets));
+        }
+        table->offsetsSize = offsetsSize;
+    }
+
+    table->width = width;
+    table->height = numRows;
+    table->isWeighted = isWeighted;
+
+    // Row 0 is both the top of the table and what every band starts from
+    memset(table->sums, 0, tableStride * sizeof(*table->sums));
+    memset(table->sumOffsets, 0, tableStride * sizeof(*table->sumOffsets));
+    if(isWeighted) {
+        memset(table->weights, 0, tableStride * sizeof(*table->weights));
+        memset(table->weightedSums, 0, tableStride * sizeof(*table->weightedSums));
+        memset(table->weightOffsets, 0, tableStride * sizeof(*table->weightOffsets));
+        memset(table->weightedOffsets, 0, tableStride * sizeof(*table->weightedOffsets));
+    }
+}
+
+
+static void* growTableArray(void *array, size_t size, size_t entrySize) {
+    if((array = realloc(array, size * entrySize)) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    return array;
+}
+
+
+void buildSummedAreaBand(SummedAreaTable *table, int band, const uint32_t *pixels, size_t stride, int rowStep) {
+    // Pixels start at the band's first sampled row
+    size_t tableStride = table->width + 1;
+    int firstRow = band * table->bandRows;
+    int lastRow = (firstRow + table->bandRows < table->height) ? firstRow + table->bandRows : table->height;
+    int width = table->width;
+
+    for(int j=firstRow; j<lastRow; j++) {
+        const uint32_t *row = pixels + (size_t)(j - firstRow) * rowStep * stride;
+        size_t aboveRow = (j == firstRow) ? 0 : j * tableStride;
+        uint32_t (*above)[3] = table->sums + aboveRow;
+        uint32_t (*sums)[3] = table->sums + (j + 1) * tableStride;
+        uint32_t rowSums[3] = {0, 0, 0};
+
+        sums[0][0] = sums[0][1] = sums[0][2] = 0;
+
+        for(int i=0; i<width; i++) {
+            rowSums[0] += (row[i] >> 16) & 0xff;
+            rowSums[1] += (row[i] >> 8)  & 0xff;
+            rowSums[2] += (row[i] >> 0)  & 0xff;
+
+            sums[i+1][0] = above[i+1][0] + rowSums[0];
+            sums[i+1][1] = above[i+1][1] + rowSums[1];
+            sums[i+1][2] = above[i+1][2] + rowSums[2];
+        }
+
+        if(!table->isWeighted) {
+            continue;
+        }
+
+        uint32_t *aboveWeights = table->weights + aboveRow;
+        uint32_t *weights = table->weights + (j + 1) * tableStride;
+        uint64_t (*aboveWeighted)[3] = table->weightedSums + aboveRow;
+        uint64_t (*weighted)[3] = table->weightedSums + (j + 1) * tableStride;
+        uint32_t rowWeight = 0;
+        uint64_t rowWeighted[3] = {0, 0, 0};
+
+        weights[0] = 0;
+        weighted[0][0] = weighted[0][1] = weighted[0][2] = 0;
+
+        for(int i=0; i<width; i++) {
+            uint32_t red   = (row[i] >> 16) & 0xff;
+            uint32_t green = (row[i] >> 8)  & 0xff;
+            uint32_t blue  = (row[i] >> 0)  & 0xff;
+            uint32_t max = red;
+            uint32_t min = red;
+
+            // Written out as plain compares so they become conditional moves instead of branches
+            max = (green > max) ? green : max;
+            max = (blue > max)  ? blue  : max;
+            min = (green < min) ? green : min;
+            min = (blue < min)  ? blue  : min;
+
+            uint32_t weight = max - min + 1;
+
+            rowWeight += weight;
+            rowWeighted[0] += weight * red;
+            rowWeighted[1] += weight * green;
+            rowWeighted[2] += weight * blue;
+
+            weights[i+1] = aboveWeights[i+1] + rowWeight;
+            weighted[i+1][0] = aboveWeighted[i+1][0] + rowWeighted[0];
+            weighted[i+1][1] = aboveWeighted[i+1][1] + rowWeighted[1];
+            weighted[i+1][2] = aboveWeighted[i+1][2] + rowWeighted[2];
+        }
+    }
+}
+
+
+void joinSummedAreaBands(SummedAreaTable *table) {
+    // Each band's offset is the previous band's offset plus that band's bottom row
+    size_t tableStride = table->width + 1;
+
+    for(int band=1; band<table->numBands; band++) {
+        size_t offset = band * tableStride;
+        size_t prevOffset = offset - tableStride;
+        size_t bottomRow = (size_t)band * table->bandRows * tableStride;
+
+        for(size_t i=0; i<tableStride; i++) {
+            for(int c=0; c<3; c++) {
+                table->sumOffsets[offset + i][c] = table->sumOffsets[prevOffset + i][c] + table->sums[bottomRow + i][c];
+            }
+        }
+
+        if(!table->isWeighted) {
+            continue;
+        }
+
+        for(size_t i=0; i<tableStride; i++) {
+            table->weightOffsets[offset + i] = table->weightOffsets[prevOffset + i] + table->weights[bottomRow + i];
+            for(int c=0; c<3; c++) {
+                table->weightedOffsets[offset + i][c] = table->weightedOffsets[prevOffset + i][c] + table->weightedSums[bottomRow + i][c];
+            }
+        }
+    }
+}
+
+
+void buildSummedAreaTable(SummedAreaTable *table, const uint32_t *pixels, size_t stride, int width, int height, int rowStep, int isWeighted) {
+    prepareSummedAreaTable(table, width, height, rowStep, 1, isWeighted);
+    buildSummedAreaBand(table, 0, pixels, stride, rowStep);
+    joinSummedAreaBands(table);
+}
+
+
+static size_t getBandEntry(const SummedAreaTable *table, int row, int x) {
+    // Index of the offset entry for an entry of the table; row 0 goes with the first band
+    int band = (row > 0) ? (row - 1) / table->bandRows : 0;
+    return band * (table->width + 1) + x;
+}
+
+
+void getAreaMean(const SummedAreaTable *table, int x, int row, int width, int numRows, unsigned char *rgb) {
+    size_t tableStride = table->width + 1;
+    size_t topLeft = row * tableStride + x;
+    size_t bottomLeft = (row + numRows) * tableStride + x;
+    size_t topOffset = getBandEntry(table, row, x);
+    size_t bottomOffset = getBandEntry(table, row + numRows, x);
+    uint32_t count = width * numRows;
+
+    for(int i=0; i<3; i++) {
+        uint32_t bottom = table->sums[bottomLeft + width][i] - table->sums[bottomLeft][i] + table->sumOffsets[bottomOffset + width][i] - table->sumOffsets[bottomOffset][i];
+        uint32_t top = table->sums[topLeft + width][i] - table->sums[topLeft][i] + table->sumOffsets[topOffset + width][i] - table->sumOffsets[topOffset][i];
+        uint32_t sum = bottom - top;
+        rgb[i] = (sum + count / 2) / count;
+    }
+}
+
+
+void getAreaWeightedMean(const SummedAreaTable *table, int x, int row, int width, int numRows, unsigned char *rgb) {
+    size_t tableStride = table->width + 1;
+    size_t topLeft = row * tableStride + x;
+    size_t bottomLeft = (row + numRows) * tableStride + x;
+    size_t topOffset = getBandEntry(table, row, x);
+    size_t bottomOffset = getBandEntry(table, row + numRows, x);
+
+    uint32_t bottomWeight = table->weights[bottomLeft + width] - table->weights[bottomLeft] + table->weightOffsets[bottomOffset + width] - table->weightOffsets[bottomOffset];
+    uint32_t topWeight = table->weights[topLeft + width] - table->weights[topLeft] + table->weightOffsets[topOffset + width] - table->weightOffsets[topOffset];
+    uint64_t weight = (uint32_t)(bottomWeight - topWeight);
+
+    for(int i=0; i<3; i++) {
+        uint64_t bottom = table->weightedSums[bottomLeft + width][i] - table->weightedSums[bottomLeft][i] + table->weightedOffsets[bottomOffset + width][i] - table->weightedOffsets[bottomOffset][i];
+        uint64_t top = table->weightedSums[topLeft + width][i] - table->weightedSums[topLeft][i] + table->weightedOffsets[topOffset + width][i] - table->weightedOffsets[topOffset][i];
+        rgb[i] = (bottom - top + weight / 2) / weight;
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Running sums over the sampled rows of a capture strip. Entry (x, y) holds the sum of
+// every pixel left of column x and above sampled row y; row and column 0 are zeros.
+// The rows are built in bands that start from zero, each of which can be built on a
+// different thread; an entry is the stored value plus the offset row of its band.
+typedef struct SummedAreaTable {
+    int width;                   // Columns summed
+    int height;                  // Sampled rows summed
+    int isWeighted;              // Flag for the weighted sums being kept too
+    int numBands;                // Bands the rows are built in
+    int bandRows;                // Sampled rows per band; the last band may have fewer
+    size_t size;                 // Entries allocated
+    size_t offsetsSize;          // Offset entries allocated
+    uint32_t (*sums)[3];         // Sum of each channel
+    uint32_t *weights;           // Sum of the pixel weights
+    uint64_t (*weightedSums)[3]; // Sum of each channel times the pixel weight
+    uint32_t (*sumOffsets)[3];   // Entries of the row above each band, one row per band
+    uint32_t *weightOffsets;
+    uint64_t (*weightedOffsets)[3];
+} SummedAreaTable;
+
+void prepareSummedAreaTable(SummedAreaTable *table, int width, int height, int rowStep, int numBands, int isWeighted);
+void buildSummedAreaBand(SummedAreaTable *table, int band, const uint32_t *pixels, size_t stride, int rowStep);
+void joinSummedAreaBands(SummedAreaTable *table);
+void buildSummedAreaTable(SummedAreaTable *table, const uint32_t *pixels, size_t stride, int width, int height, int rowStep, int isWeighted);
+void getAreaMean(const SummedAreaTable *table, int x, int row, int width, int numRows, unsigned char *rgb);
+void getAreaWeightedMean(const SummedAreaTable *table, int x, int row, int width, int numRows, unsigned char *rgb);
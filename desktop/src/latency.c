@@ -0,0 +1,130 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Latency histograms for the stages of the main loop. Buckets are log-scale with
+ * LATENCY_SUB_BUCKETS buckets per power of two, so recording is a count leading zeros
+ * and one atomic add with no allocation or locking, and a percentile read back from
+ * them is at most 25% above the true value.
+ *
+ * Each histogram is written by only the thread of its stage. The reporting thread
+ * rolls it once per report, keeping what was added since the previous roll in a ring,
+ * so percentiles cover the last LATENCY_WINDOW reports rather than all time.
+ *
+ */
+
+#include "latency.h"
+
+static int getBucket(uint64_t latency);
+static uint64_t getBucketLimit(int bucket);
+
+
+void recordLatency(LatencyHistogram *histogram, uint64_t latency) {
+    __atomic_add_fetch(&histogram->counts[getBucket(latency)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while(latency > max && !__atomic_compare_exchange_n(&histogram->max, &max, latency, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+void rollLatencyWindow(LatencyHistogram *histogram) {
+    int window = histogram->nextWindow;
+
+    for(int i=0; i<LATENCY_BUCKETS; i++) {
+        uint64_t count = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+        histogram->windowCounts[window][i] = count - histogram->rolledCounts[i];
+        histogram->rolledCounts[i] = count;
+    }
+
+    histogram->windowMax[window] = __atomic_exchange_n(&histogram->max, 0, __ATOMIC_RELAXED);
+    histogram->nextWindow = (window + 1) % LATENCY_WINDOW;
+}
+
+
+uint64_t getLatencySamples(LatencyHistogram *histogram) {
+    uint64_t samples = 0;
+
+    for(int i=0; i<LATENCY_WINDOW; i++) {
+        for(int j=0; j<LATENCY_BUCKETS; j++) {
+            samples += histogram->windowCounts[i][j];
+        }
+    }
+
+    return samples;
+}
+
+
+uint64_t getLatencyTotal(LatencyHistogram *histogram) {
+    // Everything recorded since startup; safe to call from any thread
+    uint64_t total = 0;
+
+    for(int i=0; i<LATENCY_BUCKETS; i++) {
+        total += __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+
+void getLatencyPercentiles(LatencyHistogram *histogram, uint64_t *p50, uint64_t *p95, uint64_t *p99, uint64_t *max) {
+    uint64_t counts[LATENCY_BUCKETS] = {0};
+    uint64_t samples = 0;
+
+    *max = 0;
+    for(int i=0; i<LATENCY_WINDOW; i++) {
+        for(int j=0; j<LATENCY_BUCKETS; j++) {
+            counts[j] += histogram->windowCounts[i][j];
+            samples += histogram->windowCounts[i][j];
+        }
+
+        if(histogram->windowMax[i] > *max) {
+            *max = histogram->windowMax[i];
+        }
+    }
+
+    uint64_t *percentiles[] = {p50, p95, p99};
+    uint64_t ranks[] = {(samples + 1) / 2, (samples * 95 + 99) / 100, (samples * 99 + 99) / 100};
+    uint64_t seen = 0;
+
+    for(int i=0, j=0; i<3; i++) {
+        // Report the top of the bucket the rank falls in, but never more than the max that was actually seen
+        while(j < LATENCY_BUCKETS - 1 && seen + counts[j] < ranks[i]) {
+            seen += counts[j++];
+        }
+
+        *percentiles[i] = (samples == 0) ? 0 : getBucketLimit(j);
+        if(*percentiles[i] > *max) {
+            *percentiles[i] = *max;
+        }
+    }
+}
+
+
+static int getBucket(uint64_t latency) {
+    if(latency < LATENCY_SUB_BUCKETS) {
+        return latency;
+    }
+
+    // The power of two picks the group of buckets and the next two bits the bucket within it
+    int power = 63 - __builtin_clzll(latency);
+    int bucket = (power - 1) * LATENCY_SUB_BUCKETS + ((latency >> (power - 2)) & (LATENCY_SUB_BUCKETS - 1));
+
+    return (bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS - 1;
+}
+
+
+static uint64_t getBucketLimit(int bucket) {
+    // Smallest latency that falls in the next bucket
+    bucket++;
+
+    if(bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    return (uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (bucket / LATENCY_SUB_BUCKETS - 1);
+}
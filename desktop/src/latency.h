@@ -0,0 +1,32 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stdint.h>
+
+#define LATENCY_SUB_BUCKETS 4   // Buckets per power of two
+#define LATENCY_BUCKETS     144 // Enough for anything up to about half a minute
+#define LATENCY_WINDOW      10  // Number of rolls (one per report) percentiles are taken over
+
+typedef struct LatencyHistogram {
+    const char *name;
+    uint64_t counts[LATENCY_BUCKETS];                 // Counts since startup, updated atomically
+    uint64_t max;                                     // Longest latency since the last roll, updated atomically
+    uint64_t rolledCounts[LATENCY_BUCKETS];           // Counts as of the last roll
+    uint32_t windowCounts[LATENCY_WINDOW][LATENCY_BUCKETS]; // Ring of the counts added between each of the last rolls
+    uint64_t windowMax[LATENCY_WINDOW];
+    int nextWindow;                                   // Ring index the next roll is written to
+} LatencyHistogram;
+
+void recordLatency(LatencyHistogram *histogram, uint64_t latency);
+void rollLatencyWindow(LatencyHistogram *histogram);
+uint64_t getLatencySamples(LatencyHistogram *histogram);
+uint64_t getLatencyTotal(LatencyHistogram *histogram);
+void getLatencyPercentiles(LatencyHistogram *histogram, uint64_t *p50, uint64_t *p95, uint64_t *p99, uint64_t *max);
@@ -0,0 +1,308 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * The placement of the LEDs around the screen for the sample mode. A layout file lists
+ * the edges the strip runs along in the order the strip does, one per line:
+ *
+ *   # edge   leds  depth  [reverse]
+ *   screen   0 0 1920 1080
+ *   bottom   20    80
+ *   right    12    80
+ *   top      30    80
+ *   left     12    80
+ *
+ * Edges are top, right, bottom or left. LEDs run clockwise around the screen (left to
+ * right along the top, top to bottom down the right and so on) unless the edge is
+ * reversed, and each LED samples a region "depth" pixels deep into the screen. The
+ * optional screen line limits sampling to part of the root window, e.g. one monitor.
+ * Without a layout file the LEDs run right to left along the top and sample the full
+ * height of the screen.
+ *
+ * At startup the layout is compiled into a flat table of sample regions with one
+ * capture strip per edge. The table is in screen order so the reducers walk each strip
+ * front to back, and each region records which LED of the frame it fills.
+ *
+ * With --output the screen is the box around the outputs sampled instead and each edge
+ * gets one strip per output it crosses, so pixels between or beside the monitors are
+ * never captured. A region on the seam between two monitors samples the part of it on
+ * the monitor it mostly covers, and one off all of them is left dark. The layout is
+ * compiled again whenever the outputs move.
+ *
+ */
+
+#include "colorswirl.h"
+#include "capture.h"
+#include "layout.h"
+
+static const char *edgeNames[NUM_EDGES] = {
+    [EDGE_TOP]    = "top",
+    [EDGE_RIGHT]  = "right",
+    [EDGE_BOTTOM] = "bottom",
+    [EDGE_LEFT]   = "left"
+};
+
+static LayoutEdge edges[NUM_EDGES]; // Edges in strip order
+static int numEdges;
+static int hasScreen;               // Flag for the layout limiting sampling to part of the root window
+static int screenX;                 // Part of the root window that is sampled
+static int screenY;
+static int layoutWidth;
+static int layoutHeight;
+static int isDefaultEdge;           // Flag for the edge being made up in the absence of a layout file
+static int boxX;                    // The box the LEDs are placed around; the layout's screen or the outputs
+static int boxY;
+static int boxWidth;
+static int boxHeight;
+
+static SampleRegion *regions;       // Sample regions in screen order
+static int numRegions;
+
+static int addEdgeRegions(const LayoutEdge *edge, int firstLed, const XRectangle *areas, int numAreas);
+static int failLayout();
+
+
+void readLayout(const char *path) {
+    FILE *file;
+    char line[MAX_LAYOUT_LINE];
+    int lineNum = 0;
+
+    if((file = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "%s: Error opening layout \"%s\": %s\n", prog, path, strerror(errno));
+        exit(ABNORMAL_EXIT);
+    }
+
+    numEdges = 0;
+    numLeds = 0;
+
+    while(fgets(line, sizeof(line), file) != NULL) {
+        char name[16];
+        char flag[16];
+        int numFields;
+        LayoutEdge edge = {.edge = -1};
+
+        lineNum++;
+
+        // Skip blank lines and comments
+        if(sscanf(line, " %15s", name) != 1 || name[0] == '#') {
+            continue;
+        }
+
+        if(strcmp(name, "screen") == 0) {
+            if(sscanf(line, " screen %d %d %d %d", &screenX, &screenY, &layoutWidth, &layoutHeight) != 4 || screenX < 0 || screenY < 0 || layoutWidth < 1 || layoutHeight < 1) {
+                fprintf(stderr, "%s: %s:%d: Expected \"screen x y width height\".\n", prog, path, lineNum);
+                exit(ABNORMAL_EXIT);
+            }
+
+            hasScreen = TRUE;
+            continue;
+        }
+
+        for(int i=0; i<NUM_EDGES; i++) {
+            if(strcmp(name, edgeNames[i]) == 0) {
+                edge.edge = i;
+            }
+        }
+
+        numFields = sscanf(line, " %*s %d %d %15s", &edge.numLeds, &edge.depth, flag);
+        if(edge.edge == -1 || numFields < 2 || edge.numLeds < 1 || edge.depth < 1 || (numFields == 3 && strcmp(flag, "reverse") != 0)) {
+            fprintf(stderr, "%s: %s:%d: Expected \"top|right|bottom|left leds depth [reverse]\".\n", prog, path, lineNum);
+            exit(ABNORMAL_EXIT);
+        }
+        edge.isReversed = (numFields == 3);
+
+        for(int i=0; i<numEdges; i++) {
+            if(edges[i].edge == edge.edge) {
+                fprintf(stderr, "%s: %s:%d: The %s edge is given twice.\n", prog, path, lineNum, name);
+                exit(ABNORMAL_EXIT);
+            }
+        }
+
+        edges[numEdges++] = edge;
+        numLeds += edge.numLeds;
+    }
+
+    fclose(file);
+
+    if(numEdges == 0 || numLeds > MAX_NUM_LEDS) {
+        fprintf(stderr, "%s: Layout \"%s\" must place between 1 and %d LEDs.\n", prog, path, MAX_NUM_LEDS);
+        exit(ABNORMAL_EXIT);
+    }
+}
+
+
+int compileLayout() {
+    int screenLeds = 0;
+    int numAreas;
+    const XRectangle *areas = getScreenOutputs(&numAreas);
+    XRectangle layoutArea;
+
+    // Anything left over from the screen as it was before
+    clearCaptureStrips();
+    numRegions = 0;
+
+    if(hasScreen) {
+        if(outputNames != NULL) {
+            fprintf(stderr, "%s: The layout's screen and --output can't be used together.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+
+        if(screenX + layoutWidth > screenWidth || screenY + layoutHeight > screenHeight) {
+            fprintf(stderr, "%s: The layout's screen doesn't fit in the %dx%d root window.\n", prog, screenWidth, screenHeight);
+            return failLayout();
+        }
+
+        layoutArea = (XRectangle){.x = screenX, .y = screenY, .width = layoutWidth, .height = layoutHeight};
+        areas = &layoutArea;
+        numAreas = 1;
+    }
+
+    if(numAreas == 0) {
+        fprintf(stderr, "%s: None of the outputs sampled are on.\n", prog);
+        return failLayout();
+    }
+
+    // The LEDs go around the box holding all of the areas sampled
+    int right = areas[0].x + areas[0].width;
+    int bottom = areas[0].y + areas[0].height;
+    boxX = areas[0].x;
+    boxY = areas[0].y;
+    for(int i=1; i<numAreas; i++) {
+        boxX = (areas[i].x < boxX) ? areas[i].x : boxX;
+        boxY = (areas[i].y < boxY) ? areas[i].y : boxY;
+        right = (areas[i].x + areas[i].width > right) ? areas[i].x + areas[i].width : right;
+        bottom = (areas[i].y + areas[i].height > bottom) ? areas[i].y + areas[i].height : bottom;
+    }
+    boxWidth = right - boxX;
+    boxHeight = bottom - boxY;
+
+    // Without a layout file the whole strip runs right to left along the top
+    if(numEdges == 0 || isDefaultEdge) {
+        edges[0].edge = EDGE_TOP;
+        edges[0].numLeds = numLeds;
+        edges[0].depth = boxHeight;
+        edges[0].isReversed = TRUE;
+        numEdges = 1;
+        isDefaultEdge = TRUE;
+    }
+
+    for(int i=0; i<numEdges; i++) {
+        screenLeds += edges[i].numLeds;
+    }
+
+    if(screenLeds != numLeds) {
+        fprintf(stderr, "%s: The layout places %d LEDs but the strip has %d.\n", prog, screenLeds, numLeds);
+        exit(ABNORMAL_EXIT);
+    }
+
+    if(regions == NULL && (regions = malloc(numLeds * sizeof(SampleRegion))) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    // Lay the regions out edge by edge around the screen, numbering the LEDs in strip order
+    for(int edge=0; edge<NUM_EDGES; edge++) {
+        for(int i=0, firstLed=0; i<numEdges; firstLed+=edges[i].numLeds, i++) {
+            if(edges[i].edge == edge && !addEdgeRegions(&edges[i], firstLed, areas, numAreas)) {
+                return failLayout();
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+
+static int failLayout() {
+    // Nothing is sampled until the screen changes to something the layout fits
+    clearCaptureStrips();
+    numRegions = 0;
+    return FALSE;
+}
+
+
+static int addEdgeRegions(const LayoutEdge *edge, int firstLed, const XRectangle *areas, int numAreas) {
+    int isHorizontal = (edge->edge == EDGE_TOP || edge->edge == EDGE_BOTTOM);
+    int length = isHorizontal ? boxWidth : boxHeight;
+    int depth = edge->depth;
+
+    if(depth > (isHorizontal ? boxHeight : boxWidth) || edge->numLeds > length) {
+        fprintf(stderr, "%s: The %s edge doesn't fit on a %dx%d screen.\n", prog, edgeNames[edge->edge], boxWidth, boxHeight);
+        return FALSE;
+    }
+
+    // The edge is grabbed as one strip per area it crosses; the regions split its length as evenly as possible
+    int stripX = boxX + ((edge->edge == EDGE_RIGHT)  ? boxWidth - depth  : 0);
+    int stripY = boxY + ((edge->edge == EDGE_BOTTOM) ? boxHeight - depth : 0);
+    int stripWidth = isHorizontal ? boxWidth : depth;
+    int stripHeight = isHorizontal ? depth : boxHeight;
+    int firstStrip = -1;
+    int numEdgeStrips = 0;
+
+    for(int i=0; i<numAreas; i++) {
+        int left = (areas[i].x > stripX) ? areas[i].x : stripX;
+        int top = (areas[i].y > stripY) ? areas[i].y : stripY;
+        int right = (areas[i].x + areas[i].width < stripX + stripWidth) ? areas[i].x + areas[i].width : stripX + stripWidth;
+        int bottom = (areas[i].y + areas[i].height < stripY + stripHeight) ? areas[i].y + areas[i].height : stripY + stripHeight;
+
+        if(right > left && bottom > top) {
+            int strip = addCaptureStrip(left, top, right - left, bottom - top);
+            firstStrip = (firstStrip == -1) ? strip : firstStrip;
+            numEdgeStrips++;
+        }
+    }
+
+    int numStrips;
+    CaptureStrip *strips = getCaptureStrips(&numStrips);
+
+    // Clockwise is left to right along the top and right to left along the bottom
+    int isBackwards = edge->isReversed ^ (edge->edge == EDGE_BOTTOM || edge->edge == EDGE_LEFT);
+
+    for(int i=0; i<edge->numLeds; i++) {
+        SampleRegion *region = &regions[numRegions++];
+        int start = i * length / edge->numLeds;
+        int end = (i + 1) * length / edge->numLeds;
+        int x = stripX + (isHorizontal ? start : 0);
+        int y = stripY + (isHorizontal ? 0 : start);
+        int width = isHorizontal ? end - start : depth;
+        int height = isHorizontal ? depth : end - start;
+        int largestArea = 0;
+
+        region->x      = x;
+        region->y      = y;
+        region->width  = 0;
+        region->height = 0;
+        region->strip  = NULL;
+        region->led    = firstLed + (isBackwards ? edge->numLeds - 1 - i : i);
+
+        // Keep the part of the region on the strip it overlaps most
+        for(int j=firstStrip; j<firstStrip + numEdgeStrips; j++) {
+            int left = (strips[j].x > x) ? strips[j].x : x;
+            int top = (strips[j].y > y) ? strips[j].y : y;
+            int right = (strips[j].x + strips[j].width < x + width) ? strips[j].x + strips[j].width : x + width;
+            int bottom = (strips[j].y + strips[j].height < y + height) ? strips[j].y + strips[j].height : y + height;
+
+            if(right > left && bottom > top && (right - left) * (bottom - top) > largestArea) {
+                largestArea = (right - left) * (bottom - top);
+                region->x      = left;
+                region->y      = top;
+                region->width  = right - left;
+                region->height = bottom - top;
+                region->strip  = &strips[j];
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+
+const SampleRegion* getSampleRegions(int *numSampleRegions) {
+    *numSampleRegions = numRegions;
+    return regions;
+}
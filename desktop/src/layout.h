@@ -0,0 +1,30 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#define EDGE_TOP    0
+#define EDGE_RIGHT  1
+#define EDGE_BOTTOM 2
+#define EDGE_LEFT   3
+#define NUM_EDGES   4
+
+#define MAX_LAYOUT_LINE 256
+
+// A run of LEDs along one edge of the screen, in the order it appears on the strip
+typedef struct {
+    int edge;       // One of the EDGE_ options
+    int numLeds;    // LEDs along the edge
+    int depth;      // How far into the screen the LEDs' regions reach, in pixels
+    int isReversed; // Flag for the LEDs running counter-clockwise around the screen
+} LayoutEdge;
+
+void readLayout(const char *path);
+int compileLayout();
+const SampleRegion* getSampleRegions(int *numRegions);
@@ -0,0 +1,96 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * The main loop is split into capture, compute and transmit stages running on their
+ * own threads. Neighboring stages pass frames through a lock-free triple buffer: the
+ * writer always has a buffer to fill and swaps it with the waiting one when done, and
+ * the reader swaps its buffer with the waiting one when it wants a new frame. A slow
+ * reader therefore never holds up the writer and always gets the newest finished frame;
+ * frames it didn't get to are simply overwritten.
+ *
+ */
+
+#include "colorswirl.h"
+#include "pipeline.h"
+
+
+void initTripleBuffer(TripleBuffer *tripleBuffer, size_t frameLen) {
+    for(int i=0; i<3; i++) {
+        if((tripleBuffer->buffers[i] = calloc(frameLen, 1)) == NULL) {
+            fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+    }
+
+    tripleBuffer->writing = 0;
+    tripleBuffer->waiting = 1;
+    tripleBuffer->reading = 2;
+    sem_init(&tripleBuffer->published, 0, 0);
+}
+
+
+unsigned char* getWriteFrame(TripleBuffer *tripleBuffer) {
+    return tripleBuffer->buffers[tripleBuffer->writing];
+}
+
+
+void publishFrame(TripleBuffer *tripleBuffer) {
+    int prevWaiting = __atomic_exchange_n(&tripleBuffer->waiting, tripleBuffer->writing | FRESH_FRAME, __ATOMIC_ACQ_REL);
+    tripleBuffer->writing = prevWaiting & ~FRESH_FRAME;
+
+    // If the replaced frame was still fresh the reader hasn't gone to sleep since the last post
+    if(!(prevWaiting & FRESH_FRAME)) {
+        sem_post(&tripleBuffer->published);
+    }
+}
+
+
+unsigned char* waitForFrame(TripleBuffer *tripleBuffer) {
+    while(!(__atomic_load_n(&tripleBuffer->waiting, __ATOMIC_ACQUIRE) & FRESH_FRAME)) {
+        sem_wait(&tripleBuffer->published);
+    }
+
+    int prevWaiting = __atomic_exchange_n(&tripleBuffer->waiting, tripleBuffer->reading, __ATOMIC_ACQ_REL);
+    tripleBuffer->reading = prevWaiting & ~FRESH_FRAME;
+
+    return tripleBuffer->buffers[tripleBuffer->reading];
+}
+
+
+uint64_t getMonotonicTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+void beginStage(PipelineStage *stage) {
+    stage->startTime = getMonotonicTime();
+}
+
+
+void endStage(PipelineStage *stage) {
+    __atomic_add_fetch(&stage->busyTime, getMonotonicTime() - stage->startTime, __ATOMIC_RELAXED);
+}
+
+
+int getStageOccupancy(PipelineStage *stage, uint64_t elapsed) {
+    // Percentage of the time since the last report that the stage spent working
+    uint64_t busyTime = __atomic_load_n(&stage->busyTime, __ATOMIC_RELAXED);
+    int occupancy = (elapsed > 0) ? (int)((busyTime - stage->reportedTime) * 100 / elapsed) : 0;
+    stage->reportedTime = busyTime;
+
+    return occupancy;
+}
+
+
+uint64_t getStageBusyTime(PipelineStage *stage) {
+    return __atomic_load_n(&stage->busyTime, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,42 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRESH_FRAME 0x4 // Set on TripleBuffer.waiting until the reader takes the frame
+
+typedef struct {
+    unsigned char *buffers[3]; // Frame storage; each index is owned by exactly one of the fields below
+    int writing;               // Index of the frame the writer is filling
+    int reading;               // Index of the frame the reader is using
+    int waiting;               // Index of the newest finished frame, swapped atomically
+    sem_t published;           // Posted when a frame is published to a reader that may be asleep
+} TripleBuffer;
+
+typedef struct {
+    const char *name;
+    uint64_t busyTime;     // Total nanoseconds spent working, updated atomically
+    uint64_t startTime;    // Start of the current unit of work; only touched by the stage's thread
+    uint64_t reportedTime; // Busy time at the last occupancy report
+} PipelineStage;
+
+void initTripleBuffer(TripleBuffer *tripleBuffer, size_t frameLen);
+unsigned char* getWriteFrame(TripleBuffer *tripleBuffer);
+void publishFrame(TripleBuffer *tripleBuffer);
+unsigned char* waitForFrame(TripleBuffer *tripleBuffer);
+
+uint64_t getMonotonicTime();
+void beginStage(PipelineStage *stage);
+void endStage(PipelineStage *stage);
+int getStageOccupancy(PipelineStage *stage, uint64_t elapsed);
+uint64_t getStageBusyTime(PipelineStage *stage);
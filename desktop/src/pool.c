@@ -0,0 +1,119 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * A fixed pool of threads for splitting the reduction of a frame across cores. The
+ * threads are started once and sleep on a barrier between frames. A job is a task and
+ * a number of items: each thread, including the one that handed out the job, takes
+ * chunks of items off a shared atomic counter until none are left. Threads that finish
+ * early pick up more chunks, so uneven items balance out without a scheduler. The
+ * caller returns once every thread has reached the second barrier, so each job joins
+ * the pool exactly once.
+ *
+ * With a single worker the task just runs on the calling thread.
+ *
+ */
+
+#include "colorswirl.h"
+#include "pool.h"
+
+static void* workerLoop(void *worker);
+static void runTask(WorkerPool *pool, int worker);
+
+
+void startWorkerPool(WorkerPool *pool, int numWorkers) {
+    memset(pool, 0, sizeof(WorkerPool));
+    pool->numWorkers = (numWorkers < 1) ? 1 : (numWorkers > MAX_WORKERS) ? MAX_WORKERS : numWorkers;
+
+    if(pool->numWorkers == 1) {
+        return;
+    }
+
+    pthread_barrier_init(&pool->started, NULL, pool->numWorkers);
+    pthread_barrier_init(&pool->finished, NULL, pool->numWorkers);
+
+    // The caller is worker 0
+    for(int i=1; i<pool->numWorkers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_create(&pool->threads[i], NULL, workerLoop, &pool->workers[i]);
+    }
+}
+
+
+void stopWorkerPool(WorkerPool *pool) {
+    if(pool->numWorkers == 1) {
+        return;
+    }
+
+    pool->isStopping = TRUE;
+    pthread_barrier_wait(&pool->started);
+
+    for(int i=1; i<pool->numWorkers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_barrier_destroy(&pool->started);
+    pthread_barrier_destroy(&pool->finished);
+}
+
+
+void runOnPool(WorkerPool *pool, PoolTask task, void *arg, int numItems, int chunkSize) {
+    pool->task = task;
+    pool->arg = arg;
+    pool->numItems = numItems;
+    pool->chunkSize = (chunkSize > 0) ? chunkSize : 1;
+    pool->nextItem = 0;
+
+    if(pool->numWorkers == 1) {
+        runTask(pool, 0);
+        return;
+    }
+
+    // The barriers order the job's fields and results between the threads
+    pthread_barrier_wait(&pool->started);
+    runTask(pool, 0);
+    pthread_barrier_wait(&pool->finished);
+}
+
+
+static void* workerLoop(void *worker) {
+    Worker *self = worker;
+    WorkerPool *pool = self->pool;
+
+    while(1) {
+        pthread_barrier_wait(&pool->started);
+        if(pool->isStopping) {
+            break;
+        }
+
+        runTask(pool, self->index);
+        pthread_barrier_wait(&pool->finished);
+    }
+
+    pthread_exit(NULL);
+}
+
+
+static void runTask(WorkerPool *pool, int worker) {
+    int first;
+
+    while((first = __atomic_fetch_add(&pool->nextItem, pool->chunkSize, __ATOMIC_RELAXED)) < pool->numItems) {
+        int last = (first + pool->chunkSize < pool->numItems) ? first + pool->chunkSize : pool->numItems;
+
+        for(int i=first; i<last; i++) {
+            pool->task(pool->arg, worker, i);
+        }
+    }
+}
+
+
+int getDefaultWorkers() {
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (numCpus < 1) ? 1 : (numCpus > DEFAULT_WORKERS) ? DEFAULT_WORKERS : numCpus;
+}
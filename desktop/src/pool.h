@@ -0,0 +1,45 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <pthread.h>
+
+#define MAX_WORKERS     16
+#define DEFAULT_WORKERS 4  // Most worker threads used without --threads; colorswirl runs in the background
+#define CACHE_LINE_SIZE 64
+
+// Called once for each item of a job; worker is the index of the thread running it
+typedef void (*PoolTask)(void *arg, int worker, int item);
+
+struct WorkerPool;
+
+typedef struct {
+    struct WorkerPool *pool;
+    int index;
+} Worker;
+
+typedef struct WorkerPool {
+    int numWorkers;             // Threads working on each job, the caller's included
+    pthread_t threads[MAX_WORKERS];
+    Worker workers[MAX_WORKERS];
+    pthread_barrier_t started;  // Everyone waits here for a job
+    pthread_barrier_t finished; // and here for everyone to be done with it
+    PoolTask task;              // The current job
+    void *arg;
+    int numItems;
+    int chunkSize;              // Items taken at a time
+    int nextItem;               // Next item not taken yet, updated atomically
+    int isStopping;
+} WorkerPool;
+
+void startWorkerPool(WorkerPool *pool, int numWorkers);
+void stopWorkerPool(WorkerPool *pool);
+void runOnPool(WorkerPool *pool, PoolTask task, void *arg, int numItems, int chunkSize);
+int getDefaultWorkers();
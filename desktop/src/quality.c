@@ -0,0 +1,152 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Adaptive quality for the sample mode. With --budget, the time each capture takes is
+ * measured against a budget per frame. When a busy machine pushes the smoothed
+ * capture time over it, the controller moves down a ladder of cheaper settings:
+ *   - first sampling fewer rows
+ *   - then having the X server shrink the screen further
+ *   - finally capturing only every second, third or fourth frame
+ * When the capture time stays well under budget, it moves back up.
+ *
+ * The budget is per frame at the target frame rate, so a level that skips frames gets
+ * the time of the skipped ones too. The wait before moving up again doubles every time
+ * a move up has to be undone straight away. This keeps the controller from bouncing
+ * between two levels.
+ *
+ * Separately, a scene whose colors haven't changed for STATIC_TIME is only captured at
+ * every STATIC_FRAME_INTERVAL-th frame until something changes again. The smoothing is
+ * frame rate independent, so neither of these changes how the lights look, only how
+ * quickly they follow.
+ *
+ */
+
+#include "colorswirl.h"
+#include "pipeline.h"
+#include "quality.h"
+
+static const QualityLevel qualityLevels[] = {
+    // Scale, row step, frame interval
+    {1, 1, 1},
+    {1, 2, 1},
+    {2, 1, 1},
+    {2, 2, 1},
+    {4, 1, 1},
+    {4, 2, 1},
+    {4, 2, 2},
+    {4, 2, 3},
+    {4, 2, 4}
+};
+#define NUM_QUALITY_LEVELS (int)(sizeof(qualityLevels) / sizeof(qualityLevels[0]))
+
+static int findUsableLevel(QualityController *controller, int level, int direction);
+static void setLevel(QualityController *controller, int level, uint64_t now);
+
+
+void initQualityController(QualityController *controller, double budget, int canScale) {
+    memset(controller, 0, sizeof(QualityController));
+    controller->budget = budget * 1000000;
+    controller->cost = -1;
+    controller->canScale = canScale;
+    controller->recoverDelay = QUALITY_RECOVER_TIME;
+    controller->changeTime = controller->lastChange = getMonotonicTime();
+}
+
+
+int updateQuality(QualityController *controller, uint64_t frameTime, uint64_t cost, int isChanged) {
+    uint64_t budget = controller->budget * getQualityFrameInterval(controller);
+    int isUpdated = FALSE;
+
+    if(cost > budget) {
+        __atomic_add_fetch(&controller->budgetMisses, 1, __ATOMIC_RELAXED);
+    }
+
+    // Slow down on a static scene and speed straight back up on the first change
+    if(isChanged) {
+        controller->lastChange = frameTime;
+    }
+    int isStatic = (frameTime - controller->lastChange >= STATIC_TIME);
+    if(isStatic != controller->isStatic) {
+        __atomic_store_n(&controller->isStatic, isStatic, __ATOMIC_RELAXED);
+        isUpdated = TRUE;
+    }
+
+    controller->cost = (controller->cost < 0) ? cost : controller->cost + (cost - controller->cost) / 8;
+
+    // Give a new level a few frames to show what it costs
+    if(frameTime - controller->changeTime < QUALITY_SETTLE_TIME) {
+        return isUpdated;
+    }
+
+    int level = controller->level;
+    if(controller->cost > budget) {
+        int lowerLevel = findUsableLevel(controller, level + 1, 1);
+
+        if(lowerLevel != -1) {
+            // Moving up didn't work out; wait longer before trying again
+            if(controller->isProbing && frameTime - controller->changeTime < controller->recoverDelay) {
+                controller->recoverDelay = (controller->recoverDelay * 2 < QUALITY_MAX_RECOVER) ? controller->recoverDelay * 2 : QUALITY_MAX_RECOVER;
+            } else {
+                controller->recoverDelay = QUALITY_RECOVER_TIME;
+            }
+
+            setLevel(controller, lowerLevel, frameTime);
+            controller->isProbing = FALSE;
+            isUpdated = TRUE;
+        }
+    } else if(controller->cost < budget * QUALITY_RECOVER_RATIO && level > 0) {
+        if(controller->recoverTime == 0) {
+            controller->recoverTime = frameTime;
+        } else if(frameTime - controller->recoverTime >= controller->recoverDelay) {
+            setLevel(controller, findUsableLevel(controller, level - 1, -1), frameTime);
+            controller->isProbing = TRUE;
+            isUpdated = TRUE;
+        }
+    } else {
+        controller->recoverTime = 0;
+    }
+
+    return isUpdated;
+}
+
+
+static int findUsableLevel(QualityController *controller, int level, int direction) {
+    // Levels that shrink the screen are passed over if the X server can't
+    for(; level >= 0 && level < NUM_QUALITY_LEVELS; level += direction) {
+        if(qualityLevels[level].scale == 1 || controller->canScale) {
+            return level;
+        }
+    }
+
+    return -1;
+}
+
+
+static void setLevel(QualityController *controller, int level, uint64_t now) {
+    __atomic_store_n(&controller->level, level, __ATOMIC_RELAXED);
+    controller->changeTime = now;
+    controller->recoverTime = 0;
+    controller->cost = -1;
+}
+
+
+const QualityLevel* getQualityLevel(QualityController *controller) {
+    return &qualityLevels[__atomic_load_n(&controller->level, __ATOMIC_RELAXED)];
+}
+
+
+int getQualityFrameInterval(QualityController *controller) {
+    int frameInterval = getQualityLevel(controller)->frameInterval;
+    return __atomic_load_n(&controller->isStatic, __ATOMIC_RELAXED) ? frameInterval * STATIC_FRAME_INTERVAL : frameInterval;
+}
+
+
+int getNumQualityLevels() {
+    return NUM_QUALITY_LEVELS;
+}
@@ -0,0 +1,45 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stdint.h>
+
+#define QUALITY_SETTLE_TIME   200000000  // ns to measure a new level for before moving down again
+#define QUALITY_RECOVER_TIME  2000000000 // ns of running well under budget before moving up
+#define QUALITY_RECOVER_RATIO 0.5        // Share of the budget the cost must stay under to move up
+#define QUALITY_MAX_RECOVER   64000000000 // ns the wait before moving up grows to when moving up keeps failing
+#define STATIC_TIME           1000000000 // ns without any change before the scene counts as static
+#define STATIC_FRAME_INTERVAL 4          // Deadlines per capture while the scene is static
+
+typedef struct {
+    int scale;         // Multiplies the capture scale
+    int rowStep;       // Multiplies the sampling row step
+    int frameInterval; // Deadlines per capture
+} QualityLevel;
+
+typedef struct {
+    uint64_t budget;       // ns of capture time allowed per deadline
+    double cost;           // Smoothed capture time of recent frames in ns; negative when just reset
+    int level;             // Index into the quality levels, updated atomically; 0 is full quality
+    int canScale;          // Flag for the X server being able to shrink captures
+    uint64_t changeTime;   // When the level last changed
+    uint64_t recoverTime;  // Since when the cost has been well under budget; 0 if it isn't
+    uint64_t recoverDelay; // How long that has to last; doubles each time moving up has to be undone
+    int isProbing;         // Flag for the last change having been a move up
+    uint64_t lastChange;   // When the captured colors last changed
+    int isStatic;          // Flag for the scene not having changed for STATIC_TIME, updated atomically
+    uint64_t budgetMisses; // Frames that went over budget, updated atomically
+} QualityController;
+
+void initQualityController(QualityController *controller, double budget, int canScale);
+int updateQuality(QualityController *controller, uint64_t frameTime, uint64_t cost, int isChanged);
+const QualityLevel* getQualityLevel(QualityController *controller);
+int getQualityFrameInterval(QualityController *controller);
+int getNumQualityLevels();
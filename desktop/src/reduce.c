@@ -0,0 +1,304 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Reduction of a screen region to the mode of each color channel. The per-channel
+ * 256 bucket histograms for a region are built in one pass over its pixels and the
+ * most common value of each channel is then picked out of them. Ties go to the
+ * lowest channel value.
+ *
+ * The scalar kernel is the reference. The SSE2 and AVX2 kernels look at four or eight
+ * pixels at a time: runs of identical pixels, which make up most of a desktop, are
+ * counted with one add per channel and the histograms are searched with vector
+ * instructions. They must produce exactly the same results as the scalar kernel.
+ *
+ * Counting is a scatter into the histograms whichever kernel does it, so the vector
+ * kernels only win on flat content and lose a little on noisy content such as video.
+ * Which one is faster therefore depends on what's on the screen. Reductions start on
+ * the scalar kernel and every CALIBRATION_PERIOD calls the next CALIBRATION_CALLS are
+ * spread over all kernels the CPU supports and timed; the one with the fewest ns per
+ * pixel is used until the next round.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "reduce.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define NUM_CHANNELS       3
+#define MAX_KERNELS        3
+#define CALIBRATION_CALLS  96   // Calls timed in each round, spread evenly over the kernels
+#define CALIBRATION_PERIOD 4096 // Calls from the start of one round to the start of the next
+
+typedef struct {
+    const char *name;
+    ModeReducer reduce;
+    uint64_t time;   // ns spent in the current round, updated atomically
+    uint64_t pixels; // Pixels counted in the current round, updated atomically
+} ModeKernel;
+
+static ModeKernel kernels[MAX_KERNELS] = {{"scalar", reduceModeScalar, 0, 0}};
+static int numKernels = 1;   // Kernels the running CPU supports
+static int currentKernel;    // Kernel used outside of the rounds, updated atomically
+static uint64_t numCalls;    // Calls to reduceMode(), updated atomically
+
+static uint64_t getKernelTime();
+static void pickFastestKernel();
+
+
+void initReducers() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("sse2")) {
+        kernels[numKernels++] = (ModeKernel){"sse2", reduceModeSse2, 0, 0};
+    }
+    if(__builtin_cpu_supports("avx2")) {
+        kernels[numKernels++] = (ModeKernel){"avx2", reduceModeAvx2, 0, 0};
+    }
+#endif
+}
+
+
+const char* getModeReducerName() {
+    return kernels[__atomic_load_n(&currentKernel, __ATOMIC_RELAXED)].name;
+}
+
+
+void reduceMode(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb) {
+    uint64_t call = __atomic_fetch_add(&numCalls, 1, __ATOMIC_RELAXED) % CALIBRATION_PERIOD;
+
+    if(numKernels == 1 || call >= CALIBRATION_CALLS) {
+        kernels[__atomic_load_n(&currentKernel, __ATOMIC_RELAXED)].reduce(pixels, stride, width, height, rowStep, rgb);
+        return;
+    }
+
+    // A calibration call; consecutive calls go to different kernels so they see the same mix of regions
+    ModeKernel *kernel = &kernels[call % numKernels];
+    uint64_t startTime = getKernelTime();
+    kernel->reduce(pixels, stride, width, height, rowStep, rgb);
+
+    __atomic_add_fetch(&kernel->time, getKernelTime() - startTime, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&kernel->pixels, (uint64_t)width * ((height + rowStep - 1) / rowStep), __ATOMIC_RELAXED);
+
+    if(call == CALIBRATION_CALLS - 1) {
+        pickFastestKernel();
+    }
+}
+
+
+static uint64_t getKernelTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static void pickFastestKernel() {
+    // Calls on other threads may still be finishing; being off by a call doesn't change the pick
+    int fastest = 0;
+    double fastestTime = 0;
+
+    for(int i=0; i<numKernels; i++) {
+        uint64_t time = __atomic_exchange_n(&kernels[i].time, 0, __ATOMIC_RELAXED);
+        uint64_t pixels = __atomic_exchange_n(&kernels[i].pixels, 0, __ATOMIC_RELAXED);
+        double timePerPixel = (pixels > 0) ? (double)time / pixels : 0;
+
+        if(pixels > 0 && (fastestTime == 0 || timePerPixel < fastestTime)) {
+            fastest = i;
+            fastestTime = timePerPixel;
+        }
+    }
+
+    __atomic_store_n(&currentKernel, fastest, __ATOMIC_RELAXED);
+}
+
+
+void reduceModeScalar(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb) {
+    uint32_t buckets[NUM_CHANNELS][NUM_BUCKETS];
+    memset(buckets, 0, sizeof(buckets));
+
+    for(int y=0; y<height; y+=rowStep) {
+        const uint32_t *row = pixels + y * stride;
+
+        for(int x=0; x<width; x++) {
+            buckets[0][(row[x] >> 16) & 0xff]++;
+            buckets[1][(row[x] >> 8)  & 0xff]++;
+            buckets[2][(row[x] >> 0)  & 0xff]++;
+        }
+    }
+
+    for(int i=0; i<NUM_CHANNELS; i++) {
+        rgb[i] = getModeOfHistogram(buckets[i]);
+    }
+}
+
+
+int getModeOfHistogram(const uint32_t *buckets) {
+    uint32_t max = buckets[0];
+    int maxIndex = 0;
+
+    for(int i=1; i<NUM_BUCKETS; i++) {
+        if(buckets[i] > max) {
+            max = buckets[i];
+            maxIndex = i;
+        }
+    }
+
+    return maxIndex;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static int getModeOfHistogramSse2(const uint32_t *buckets) {
+    // Bucket counts never reach 2^31 so the signed comparison is safe
+    __m128i max = _mm_loadu_si128((const __m128i*)buckets);
+    for(int i=4; i<NUM_BUCKETS; i+=4) {
+        __m128i cur = _mm_loadu_si128((const __m128i*)&buckets[i]);
+        __m128i isGreater = _mm_cmpgt_epi32(cur, max);
+        max = _mm_or_si128(_mm_and_si128(isGreater, cur), _mm_andnot_si128(isGreater, max));
+    }
+
+    // Spread the largest count across all lanes
+    for(int shift=0; shift<2; shift++) {
+        __m128i swapped = shift == 0 ? _mm_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)) : _mm_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128i isGreater = _mm_cmpgt_epi32(swapped, max);
+        max = _mm_or_si128(_mm_and_si128(isGreater, swapped), _mm_andnot_si128(isGreater, max));
+    }
+
+    // The mode is the first bucket holding the largest count
+    for(int i=0; i<NUM_BUCKETS; i+=4) {
+        __m128i isEqual = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&buckets[i]), max);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(isEqual));
+
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return 0;
+}
+
+
+__attribute__((target("sse2")))
+void reduceModeSse2(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb) {
+    uint32_t buckets[NUM_CHANNELS][NUM_BUCKETS];
+
+    memset(buckets, 0, sizeof(buckets));
+
+    for(int y=0; y<height; y+=rowStep) {
+        const uint32_t *row = pixels + y * stride;
+        int x = 0;
+
+        for(; x+4<=width; x+=4) {
+            __m128i pixel = _mm_loadu_si128((const __m128i*)&row[x]);
+
+            // Screens are mostly flat areas so count a run of four identical pixels at once
+            if(_mm_movemask_epi8(_mm_cmpeq_epi32(pixel, _mm_shuffle_epi32(pixel, 0))) == 0xffff) {
+                buckets[0][(row[x] >> 16) & 0xff] += 4;
+                buckets[1][(row[x] >> 8)  & 0xff] += 4;
+                buckets[2][(row[x] >> 0)  & 0xff] += 4;
+                continue;
+            }
+
+            // Otherwise count them one at a time like the scalar kernel
+            for(int h=0; h<4; h++) {
+                buckets[0][(row[x+h] >> 16) & 0xff]++;
+                buckets[1][(row[x+h] >> 8)  & 0xff]++;
+                buckets[2][(row[x+h] >> 0)  & 0xff]++;
+            }
+        }
+
+        for(; x<width; x++) {
+            buckets[0][(row[x] >> 16) & 0xff]++;
+            buckets[1][(row[x] >> 8)  & 0xff]++;
+            buckets[2][(row[x] >> 0)  & 0xff]++;
+        }
+    }
+
+    for(int c=0; c<NUM_CHANNELS; c++) {
+        rgb[c] = getModeOfHistogramSse2(buckets[c]);
+    }
+}
+
+
+__attribute__((target("avx2")))
+static int getModeOfHistogramAvx2(const uint32_t *buckets) {
+    __m256i max = _mm256_loadu_si256((const __m256i*)buckets);
+    for(int i=8; i<NUM_BUCKETS; i+=8) {
+        max = _mm256_max_epu32(max, _mm256_loadu_si256((const __m256i*)&buckets[i]));
+    }
+
+    // Spread the largest count across all lanes
+    max = _mm256_max_epu32(max, _mm256_permute2x128_si256(max, max, 1));
+    max = _mm256_max_epu32(max, _mm256_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)));
+    max = _mm256_max_epu32(max, _mm256_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    // The mode is the first bucket holding the largest count
+    for(int i=0; i<NUM_BUCKETS; i+=8) {
+        __m256i isEqual = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)&buckets[i]), max);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(isEqual));
+
+        if(mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return 0;
+}
+
+
+__attribute__((target("avx2")))
+void reduceModeAvx2(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb) {
+    uint32_t buckets[NUM_CHANNELS][NUM_BUCKETS];
+
+    memset(buckets, 0, sizeof(buckets));
+
+    for(int y=0; y<height; y+=rowStep) {
+        const uint32_t *row = pixels + y * stride;
+        int x = 0;
+
+        for(; x+8<=width; x+=8) {
+            __m256i pixel = _mm256_loadu_si256((const __m256i*)&row[x]);
+
+            // Screens are mostly flat areas so count a run of eight identical pixels at once
+            if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(pixel, _mm256_set1_epi32(row[x]))) == -1) {
+                buckets[0][(row[x] >> 16) & 0xff] += 8;
+                buckets[1][(row[x] >> 8)  & 0xff] += 8;
+                buckets[2][(row[x] >> 0)  & 0xff] += 8;
+                continue;
+            }
+
+            // Otherwise count them one at a time like the scalar kernel
+            for(int i=0; i<8; i++) {
+                buckets[0][(row[x+i] >> 16) & 0xff]++;
+                buckets[1][(row[x+i] >> 8)  & 0xff]++;
+                buckets[2][(row[x+i] >> 0)  & 0xff]++;
+            }
+        }
+
+        for(; x<width; x++) {
+            buckets[0][(row[x] >> 16) & 0xff]++;
+            buckets[1][(row[x] >> 8)  & 0xff]++;
+            buckets[2][(row[x] >> 0)  & 0xff]++;
+        }
+    }
+
+    for(int c=0; c<NUM_CHANNELS; c++) {
+        rgb[c] = getModeOfHistogramAvx2(buckets[c]);
+    }
+}
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NUM_BUCKETS 256
+
+// Pixels are 32 bit 0x00RRGGBB values; stride is the distance between rows in pixels
+typedef void (*ModeReducer)(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb);
+
+void initReducers();
+const char* getModeReducerName();
+void reduceMode(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb);
+void reduceModeScalar(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb);
+#if defined(__x86_64__) || defined(__i386__)
+void reduceModeSse2(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb);
+void reduceModeAvx2(const uint32_t *pixels, size_t stride, int width, int height, int rowStep, unsigned char *rgb);
+#endif
+int getModeOfHistogram(const uint32_t *buckets);
@@ -0,0 +1,162 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Run-length encoded frames. They use the same header as plain frames except that the
+ * magic word is "Adr", so a device can accept both kinds and the host can fall back to a
+ * plain frame whenever encoding wouldn't make it smaller. The color data is a series of
+ * tokens, each one byte holding the number of LEDs it covers minus one (up to
+ * RLE_MAX_COUNT) with RLE_RUN set if it is a run:
+ *
+ *   run:     token, R, G, B          - the color is repeated for every LED in the token
+ *   literal: token, R, G, B, R, ...  - 3 bytes of color follow for every LED in the token
+ *
+ * The decoder is a reference for the microcontroller side. It follows the header and data
+ * modes of arduino/coupled/coupled.ino one byte at a time and never needs more than the
+ * current token, so it can stream LEDs out as they are decoded just like the bridge does.
+ *
+ */
+
+#include "colorswirl.h"
+#include "rle.h"
+
+static int getRunLength(const unsigned char *pixel, const unsigned char *end);
+
+
+size_t encodeLedData(const unsigned char *ledData, size_t ledDataLen, unsigned char *encodedData) {
+    const unsigned char *pixel = ledData + 6;
+    const unsigned char *end = ledData + ledDataLen;
+    unsigned char *out = encodedData + 6;
+
+    // Same header as the plain frame, only the magic word differs
+    memcpy(encodedData, ledData, 6);
+    encodedData[2] = RLE_MAGIC;
+
+    while(pixel < end) {
+        int runLength = getRunLength(pixel, end);
+
+        if(runLength > 1) {
+            *out++ = RLE_RUN | (runLength - 1);
+            memcpy(out, pixel, 3);
+            out += 3;
+            pixel += runLength * 3;
+        } else {
+            // Take LEDs up to the start of the next run
+            unsigned char *token = out++;
+            int literalLength = 0;
+
+            while(pixel < end && literalLength < RLE_MAX_COUNT && getRunLength(pixel, end) == 1) {
+                memcpy(out, pixel, 3);
+                out += 3;
+                pixel += 3;
+                literalLength++;
+            }
+
+            *token = literalLength - 1;
+        }
+
+        // Not worth it; send the plain frame instead
+        if((size_t)(out - encodedData) >= ledDataLen) {
+            return 0;
+        }
+    }
+
+    return out - encodedData;
+}
+
+
+static int getRunLength(const unsigned char *pixel, const unsigned char *end) {
+    int runLength = 1;
+
+    for(const unsigned char *next = pixel + 3; next < end && runLength < RLE_MAX_COUNT; next += 3, runLength++) {
+        if(next[0] != pixel[0] || next[1] != pixel[1] || next[2] != pixel[2]) {
+            break;
+        }
+    }
+
+    return runLength;
+}
+
+
+void initRleDecoder(RleDecoder *decoder, unsigned char *ledData, int maxLeds) {
+    memset(decoder, 0, sizeof(RleDecoder));
+    decoder->mode = MODE_HEADER;
+    decoder->ledData = ledData;
+    decoder->maxLeds = maxLeds;
+}
+
+
+int decodeLedData(RleDecoder *decoder, unsigned char byte) {
+    unsigned char *header = decoder->header;
+    size_t frameLen = decoder->numLeds * 3;
+
+    switch(decoder->mode) {
+        case MODE_HEADER:
+            // Slide the byte into the header window and check for a magic word and a valid checksum
+            memmove(header, header + 1, 5);
+            header[5] = byte;
+
+            if(header[0] == 'A' && header[1] == 'd' && (header[2] == 'a' || header[2] == RLE_MAGIC) && header[5] == (header[3] ^ header[4] ^ 0x55)) {
+                decoder->numLeds = (header[3] << 8) + header[4] + 1;
+
+                // A frame too big for the buffer can't be shown; keep searching
+                if(decoder->numLeds <= decoder->maxLeds) {
+                    decoder->isEncoded = (header[2] == RLE_MAGIC);
+                    decoder->bytesDecoded = 0;
+                    decoder->literalBytes = 0;
+                    decoder->runBytes = 0;
+                    decoder->mode = MODE_DATA;
+                }
+
+                memset(header, 0, 6);
+            }
+            return 0;
+
+        case MODE_DATA:
+            if(!decoder->isEncoded || decoder->literalBytes > 0) {
+                decoder->ledData[decoder->bytesDecoded++] = byte;
+                if(decoder->literalBytes > 0) {
+                    decoder->literalBytes--;
+                }
+            } else if(decoder->runBytes > 0) {
+                decoder->runColor[3 - decoder->runBytes--] = byte;
+
+                // Got the whole color; fill in the run
+                if(decoder->runBytes == 0) {
+                    for(int i=0; i<decoder->runCount; i++) {
+                        memcpy(decoder->ledData + decoder->bytesDecoded, decoder->runColor, 3);
+                        decoder->bytesDecoded += 3;
+                    }
+                }
+            } else {
+                int count = (byte & ~RLE_RUN) + 1;
+
+                // A token running past the end of the frame means the stream is corrupt; resync on the next header
+                if(decoder->bytesDecoded + count * 3 > frameLen) {
+                    decoder->mode = MODE_HEADER;
+                    return 0;
+                }
+
+                if(byte & RLE_RUN) {
+                    decoder->runBytes = 3;
+                    decoder->runCount = count;
+                } else {
+                    decoder->literalBytes = count * 3;
+                }
+            }
+
+            // End of data; the frame is ready to latch
+            if(decoder->bytesDecoded == frameLen) {
+                decoder->mode = MODE_HEADER;
+                return 1;
+            }
+            return 0;
+    }
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stddef.h>
+
+#define RLE_MAGIC      'r'  // Third byte of the magic word of run-length encoded frames ("Adr" instead of "Ada")
+#define RLE_RUN        0x80 // Set on a token for a run of one repeated color
+#define RLE_MAX_COUNT  128  // Most LEDs a single token can cover
+
+// Largest encoded frame for a strip; encodeLedData() gives up before output gets this big
+#define RLE_MAX_LEN(leds) (6 + ((leds) * 3) + (((leds) + RLE_MAX_COUNT - 1) / RLE_MAX_COUNT))
+
+#define MODE_HEADER 0
+#define MODE_DATA   1
+
+typedef struct {
+    int mode;                  // MODE_HEADER while searching for a magic word, MODE_DATA while filling a frame
+    unsigned char header[6];   // Last bytes seen while searching for a header
+    int isEncoded;             // Whether the current frame is run-length encoded
+    unsigned char *ledData;    // Decoded color data of the current frame, 3 bytes per LED
+    int maxLeds;               // Most LEDs ledData has room for
+    int numLeds;               // LEDs in the current frame
+    size_t bytesDecoded;       // Color bytes of the current frame decoded so far
+    int literalBytes;          // Bytes left in the current literal token
+    int runBytes;              // Bytes left of the color of the current run token
+    int runCount;              // LEDs in the current run token
+    unsigned char runColor[3];
+} RleDecoder;
+
+size_t encodeLedData(const unsigned char *ledData, size_t ledDataLen, unsigned char *encodedData);
+
+void initRleDecoder(RleDecoder *decoder, unsigned char *ledData, int maxLeds);
+int decodeLedData(RleDecoder *decoder, unsigned char byte);
@@ -0,0 +1,109 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Deadline based frame pacing. Each frame is due a fixed period after the previous
+ * deadline rather than after the previous frame finished, so the time spent rendering
+ * doesn't stretch the frame rate. The capture thread sleeps with clock_nanosleep() on an
+ * absolute deadline until it is due. If a frame runs so late that it misses the next
+ * deadline(s) too, they are dropped rather than rendered back to back to catch up.
+ *
+ * The time since the previous frame is handed back to the caller so that animations
+ * can advance by elapsed time and look the same whatever the frame rate.
+ *
+ */
+
+#include "colorswirl.h"
+#include "pipeline.h"
+#include "scheduler.h"
+
+static int compareIntervals(const void *a, const void *b);
+
+
+void initFrameScheduler(FrameScheduler *scheduler, int fps) {
+    memset(scheduler, 0, sizeof(FrameScheduler));
+
+    scheduler->period = scheduler->basePeriod = (fps > 0) ? 1000000000 / fps : 0;
+    scheduler->frameInterval = 1;
+    scheduler->deadline = scheduler->prevFrameTime = getMonotonicTime();
+}
+
+
+double waitForNextFrame(FrameScheduler *scheduler) {
+    if(scheduler->period > 0) {
+        scheduler->deadline += scheduler->period;
+        uint64_t now = getMonotonicTime();
+
+        if(now < scheduler->deadline) {
+            struct timespec deadline = {
+                .tv_sec  = scheduler->deadline / 1000000000,
+                .tv_nsec = scheduler->deadline % 1000000000
+            };
+
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+        } else if(now - scheduler->deadline >= scheduler->period) {
+            // Too late for this deadline and the next; skip ahead but stay on the same grid
+            uint64_t missed = (now - scheduler->deadline) / scheduler->period;
+            scheduler->deadline += missed * scheduler->period;
+            __atomic_add_fetch(&scheduler->droppedFrames, missed, __ATOMIC_RELAXED);
+        }
+    }
+
+    uint64_t frameTime = getMonotonicTime();
+    uint64_t interval = frameTime - scheduler->prevFrameTime;
+    scheduler->prevFrameTime = frameTime;
+
+    // Record the interval and refresh the percentiles each time the ring fills up again
+    scheduler->intervals[scheduler->nextInterval] = interval;
+    scheduler->nextInterval = (scheduler->nextInterval + 1) % JITTER_WINDOW;
+    if(scheduler->numIntervals < JITTER_WINDOW) {
+        scheduler->numIntervals++;
+    }
+
+    if(scheduler->nextInterval == 0) {
+        uint64_t sorted[JITTER_WINDOW];
+        memcpy(sorted, scheduler->intervals, sizeof(sorted));
+        qsort(sorted, JITTER_WINDOW, sizeof(uint64_t), compareIntervals);
+
+        __atomic_store_n(&scheduler->intervalP50, sorted[JITTER_WINDOW * 50 / 100], __ATOMIC_RELAXED);
+        __atomic_store_n(&scheduler->intervalP99, sorted[JITTER_WINDOW * 99 / 100], __ATOMIC_RELAXED);
+    }
+
+    return (double)interval / 1000000000;
+}
+
+
+void setFrameRate(FrameScheduler *scheduler, int fps) {
+    scheduler->basePeriod = (fps > 0) ? 1000000000 / fps : 0;
+    scheduler->period = scheduler->basePeriod * scheduler->frameInterval;
+
+    // The old grid means nothing at the new rate (and running as fast as possible doesn't keep one); start over from the current frame
+    scheduler->deadline = scheduler->prevFrameTime;
+}
+
+
+void setFrameInterval(FrameScheduler *scheduler, int frameInterval) {
+    // Only every frameInterval-th deadline of the target rate is kept. Running as fast as possible has no deadlines to skip.
+    scheduler->frameInterval = frameInterval;
+    scheduler->period = scheduler->basePeriod * frameInterval;
+}
+
+
+void getFrameJitter(FrameScheduler *scheduler, uint64_t *p50, uint64_t *p99, uint64_t *droppedFrames) {
+    *p50 = __atomic_load_n(&scheduler->intervalP50, __ATOMIC_RELAXED);
+    *p99 = __atomic_load_n(&scheduler->intervalP99, __ATOMIC_RELAXED);
+    *droppedFrames = __atomic_load_n(&scheduler->droppedFrames, __ATOMIC_RELAXED);
+}
+
+
+static int compareIntervals(const void *a, const void *b) {
+    uint64_t intervalA = *(const uint64_t*)a;
+    uint64_t intervalB = *(const uint64_t*)b;
+
+    return (intervalA > intervalB) - (intervalA < intervalB);
+}
@@ -0,0 +1,35 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stdint.h>
+
+#define DEFAULT_FPS    60
+#define JITTER_WINDOW 256 // Number of recent frame intervals the jitter percentiles are taken over
+
+typedef struct {
+    uint64_t period;                   // Nanoseconds between frames; 0 to run as fast as possible
+    uint64_t basePeriod;               // Period at the target frame rate
+    int frameInterval;                 // Deadlines of the target rate per frame, see setFrameInterval()
+    uint64_t deadline;                 // Absolute monotonic time the next frame is due
+    uint64_t prevFrameTime;            // Monotonic time the previous frame started
+    uint64_t intervals[JITTER_WINDOW]; // Ring of recent frame intervals in nanoseconds
+    int numIntervals;                  // Number of intervals recorded in the ring, up to JITTER_WINDOW
+    int nextInterval;                  // Ring index the next interval is written to
+    uint64_t droppedFrames;            // Deadlines skipped because a frame ran late, updated atomically
+    uint64_t intervalP50;              // Percentiles of the intervals in the ring, updated atomically
+    uint64_t intervalP99;
+} FrameScheduler;
+
+void initFrameScheduler(FrameScheduler *scheduler, int fps);
+double waitForNextFrame(FrameScheduler *scheduler);
+void setFrameRate(FrameScheduler *scheduler, int fps);
+void setFrameInterval(FrameScheduler *scheduler, int frameInterval);
+void getFrameJitter(FrameScheduler *scheduler, uint64_t *p50, uint64_t *p99, uint64_t *droppedFrames);
@@ -0,0 +1,114 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * Writing frames to the serial device. The device is opened non-blocking; when its
+ * output queue is full the writer sleeps in poll() until there is room again rather
+ * than retrying write() in a loop, picking up where the last partial write stopped.
+ * The number of bytes still queued is read back with TIOCOUTQ after each frame so
+ * the rest of the program can see when the device isn't keeping up.
+ *
+ */
+
+#include "colorswirl.h"
+#include "serial.h"
+
+#include <poll.h>
+#include <sys/ioctl.h>
+
+
+void openSerialWriter(SerialWriter *writer, char *device) {
+    struct termios tty;
+
+    writer->device = device;
+    writer->framesWritten = 0;
+    writer->bytesWritten = 0;
+    writer->writeStalls = 0;
+    writer->queueDepth = 0;
+
+    // Try to open the device
+    if((writer->fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
+        fprintf(stderr, "%s: Error opening device \"%s\": %s\n", prog, device, strerror(errno));
+        exit(ABNORMAL_EXIT);
+    }
+
+    // Serial port config swiped from RXTX library (rxtx.qbang.org):
+    tcgetattr(writer->fd, &tty);
+    tty.c_iflag     = INPCK;
+    tty.c_lflag     = 0;
+    tty.c_oflag     = 0;
+    tty.c_cflag     = CREAD | CS8 | CLOCAL;
+    tty.c_cc[VMIN]  = 0;
+    tty.c_cc[VTIME] = 0;
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tcsetattr(writer->fd, TCSANOW, &tty);
+}
+
+
+void writeToDevice(SerialWriter *writer, const unsigned char *data, size_t len) {
+    struct pollfd pollDevice = {
+        .fd     = writer->fd,
+        .events = POLLOUT
+    };
+
+    for(size_t bytesSent = 0; bytesSent < len;) {
+        ssize_t bytesWritten = write(writer->fd, &data[bytesSent], len - bytesSent);
+
+        if(bytesWritten > 0) {
+            bytesSent += bytesWritten;
+            continue;
+        } else if(bytesWritten == -1 && errno == EINTR) {
+            continue;
+        } else if(bytesWritten == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            fprintf(stderr, "%s: Error writing to device \"%s\": %s\n", prog, writer->device, strerror(errno));
+            exit(ABNORMAL_EXIT);
+        }
+
+        // The output queue is full; sleep until the device has taken some of it
+        __atomic_add_fetch(&writer->writeStalls, 1, __ATOMIC_RELAXED);
+
+        if(poll(&pollDevice, 1, -1) == -1 && errno != EINTR) {
+            fprintf(stderr, "%s: Error waiting for device \"%s\": %s\n", prog, writer->device, strerror(errno));
+            exit(ABNORMAL_EXIT);
+        }
+    }
+
+    __atomic_add_fetch(&writer->framesWritten, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&writer->bytesWritten, len, __ATOMIC_RELAXED);
+
+    int queueDepth;
+    if(ioctl(writer->fd, TIOCOUTQ, &queueDepth) == 0) {
+        __atomic_store_n(&writer->queueDepth, queueDepth, __ATOMIC_RELAXED);
+    }
+}
+
+
+void drainDevice(SerialWriter *writer) {
+    tcdrain(writer->fd);
+}
+
+
+int getQueueDepth(SerialWriter *writer) {
+    return __atomic_load_n(&writer->queueDepth, __ATOMIC_RELAXED);
+}
+
+
+uint64_t getFramesWritten(SerialWriter *writer) {
+    return __atomic_load_n(&writer->framesWritten, __ATOMIC_RELAXED);
+}
+
+
+uint64_t getBytesWritten(SerialWriter *writer) {
+    return __atomic_load_n(&writer->bytesWritten, __ATOMIC_RELAXED);
+}
+
+
+uint64_t getWriteStalls(SerialWriter *writer) {
+    return __atomic_load_n(&writer->writeStalls, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,30 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct SerialWriter {
+    char *device;           // Path of the device
+    int fd;                 // Non-blocking descriptor of the device
+    uint64_t framesWritten; // Frames written to the device, updated atomically
+    uint64_t bytesWritten;  // Bytes written to the device, updated atomically
+    uint64_t writeStalls;   // Times a write had to wait for room in the output queue, updated atomically
+    int queueDepth;         // Bytes left in the output queue after the last write, updated atomically
+} SerialWriter;
+
+void openSerialWriter(SerialWriter *writer, char *device);
+void writeToDevice(SerialWriter *writer, const unsigned char *data, size_t len);
+void drainDevice(SerialWriter *writer);
+int getQueueDepth(SerialWriter *writer);
+uint64_t getFramesWritten(SerialWriter *writer);
+uint64_t getBytesWritten(SerialWriter *writer);
+uint64_t getWriteStalls(SerialWriter *writer);
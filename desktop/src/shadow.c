@@ -0,0 +1,57 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * The brightness wave of the calculated modes is (0.5 + sin(x) * 0.5)^3. Rather than
+ * evaluating it for every LED it is tabulated once at startup over one turn, and the
+ * positions along the wave are kept as fixed-point phases so stepping from one LED to
+ * the next is a single integer add. With 4096 entries the table is within 0.25 of the
+ * exact curve between neighboring entries, so lookups stay within 1 of the truncated
+ * floating point result.
+ *
+ * Both loops take restrict pointers and have no branches so the compiler is free to
+ * vectorize them where the target has byte gathers and shuffles (e.g. -O3 -mavx2).
+ *
+ */
+
+#include "colorswirl.h"
+#include "shadow.h"
+
+static unsigned char shadowTable[SHADOW_TABLE_LEN];
+
+
+void initShadowTable() {
+    for(int i=0; i<SHADOW_TABLE_LEN; i++) {
+        shadowTable[i] = (unsigned char)(pow(0.5 + sin(i * 2 * M_PI / SHADOW_TABLE_LEN) * 0.5, 3.0) * 255.0);
+    }
+}
+
+
+Phase radiansToPhase(double radians) {
+    // Only the fraction of a turn matters; going through int64_t keeps negative angles wrapping correctly
+    return (Phase)(int64_t)llround(fmod(radians / (2 * M_PI), 1.0) * 4294967296.0);
+}
+
+
+void getShadowBrightness(unsigned char *restrict brightness, int len, Phase phase, Phase step) {
+    // Round to the nearest entry rather than the one below
+    phase += 1u << (SHADOW_PHASE_SHIFT - 1);
+
+    for(int i=0; i<len; i++) {
+        brightness[i] = shadowTable[(Phase)(phase + (Phase)i * step) >> SHADOW_PHASE_SHIFT];
+    }
+}
+
+
+void shadeLedData(unsigned char *restrict ledData, const unsigned char *restrict brightness, int len) {
+    for(int i=0; i<len; i++) {
+        ledData[i*3]   = (ledData[i*3]   * brightness[i]) / 255;
+        ledData[i*3+1] = (ledData[i*3+1] * brightness[i]) / 255;
+        ledData[i*3+2] = (ledData[i*3+2] * brightness[i]) / 255;
+    }
+}
@@ -0,0 +1,24 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+#include <stdint.h>
+
+#define SHADOW_TABLE_BITS  12
+#define SHADOW_TABLE_LEN   (1 << SHADOW_TABLE_BITS)
+#define SHADOW_PHASE_SHIFT (32 - SHADOW_TABLE_BITS)
+
+// Angles are fixed-point turns: 2^32 is one full turn so they wrap around for free
+typedef uint32_t Phase;
+
+void initShadowTable();
+Phase radiansToPhase(double radians);
+void getShadowBrightness(unsigned char *restrict brightness, int len, Phase phase, Phase step);
+void shadeLedData(unsigned char *restrict ledData, const unsigned char *restrict brightness, int len);
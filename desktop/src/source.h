@@ -0,0 +1,29 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ */
+
+// Where the sample mode's frames come from. A source fills the capture strips' images;
+// the strips themselves and the damage bookkeeping are kept in capture.c.
+typedef struct {
+    const char *name;
+    void (*open)();                                            // Connects to the frames and sets the screen size
+    const XRectangle* (*getOutputs)(int *numOutputs);          // Parts of the screen that are sampled
+    int (*hasScreenChanged)();                                 // Flag for the outputs having moved since the last call
+    void (*createStrip)(CaptureStrip *strip);                  // Sets up the strip's image at the strip's scale
+    void (*destroyStrip)(CaptureStrip *strip);
+    int (*setScale)(int scale);                                // Called before the strips are set up again at a new scale
+    int (*canScale)();
+    int (*fetchDamage)(XRectangle **rects, int *numRects);     // Returns the flag for the whole screen counting as damaged
+    void (*captureStrip)(CaptureStrip *strip);
+    unsigned long (*getRequests)();                            // Running count of requests made for captures
+} FrameSource;
+
+extern const FrameSource x11Source;
+extern const FrameSource videoSource;
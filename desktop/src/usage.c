@@ -10,9 +10,11 @@
  */
 
 #include "usage.h"
+#include "filter.h"
+#include "scheduler.h"
 
 void printUsage(char *prog) {
-    printf("Usage: %s [options] [device]\n", prog);
+    printf("Usage: %s [options] [device[:leds] ...]\n", prog);
     
     printf("\t--color\t\t-c\t\tColor to use\n");
     printf("\t\tSupported colors:\n\t\t  multi (default)\n\t\t  red\n\t\t  orange\n\t\t  yellow\n\t\t  green\n\t\t  blue\n\t\t  purple\n\t\t  white\n\t\t  cool\n\n");
@@ -34,15 +36,51 @@ void printUsage(char *prog) {
     printf("\t\tSimply shows the selected color at full brightness. Takes an optional fade speed for fading between colors if multi color is selected.\n\n");
     printf("\t\tSupported fade speeds:\n\t\t  vs\tvery_slow\n\t\t  s\tslow\n\t\t  \tnormal (default)\n\t\t  f\tfast\n\t\t  vf\tvery_fast\n\n");
     
-    printf("\t--no-fork\t-F\t\tDon't fork on start; not implemented in the update program.\n");
-    printf("\t--verbose\t-v\t\tIncrease verbosity. Can be specified multiple times.\n");
-    printf("\t\tSingle verbose will show \"frame rate\" and bytes/sec. Double verbose is \n\t\tshows message queue info. Triple verbose will show all info\n\t\t\
+    printf("\t--leds\t\t-l\t\tNumber of LEDs on the strip (default 25). Can't be changed while running.\n\n");
+
+    printf("\t--fps\t\t-p\t\tFrames per second to generate or sample (default %d). 0 runs as fast as possible.\n", DEFAULT_FPS);
+    printf("\t\tAnimations move at the same speed whatever the frame rate.\n\n");
+
+    printf("\t--sample\t-m\t\tSample the colors along the top of the screen instead of generating them.\n\t\tCan't be changed while running.\n");
+    printf("\t--layout\t-L\t\tFile placing the LEDs along the edges of the screen for --sample, one edge per line in\n\t\tstrip order: \"top|right|bottom|left leds depth [reverse]\", plus an optional \"screen x y width height\".\n\t\tLEDs run clockwise unless reversed. Sets the LED count. Without it the LEDs run right to left\n\t\talong the top. Can't be changed while running.\n");
+    printf("\t--output\t-O\t\tComma separated XRandR outputs (up to 4, e.g. DP-1,HDMI-1) the LEDs are placed around for\n\t\t--sample. Only those monitors are captured and the layout follows them when they're rearranged.\n\t\tNeeds libXrandr. Can't be used with a layout's screen line. Can't be changed while running.\n");
+    printf("\t--input\t\t-i\t\tSample frames read from a YUV4MPEG2 stream instead of the screen, e.g. from\n\t\t\"ffmpeg ... -f yuv4mpegpipe -\". Give a path or - for stdin, or \"rgb:WIDTHxHEIGHT[@FPS]:PATH\"\n\t\tfor raw packed RGB. Frames are taken at the stream's rate. Can't be changed while running.\n");
+    printf("\t--no-shm\t-N\t\tCapture the screen with XGetImage even if the MIT-SHM extension is available.\n\t\tUseful for comparing frame rates of the two capture paths with --verbose.\n\t\tCan't be changed while running.\n\n");
+
+    printf("\t--no-damage\t-G\t\tCapture and reduce the whole screen every frame instead of only the parts XDamage\n\t\treports as drawn to. Double verbose prints the regions reduced each frame. Can't be changed while running.\n\n");
+
+    printf("\t--reducer\t-R\t\tHow each sample region is reduced to one color. Can't be changed while running.\n");
+    printf("\t\tSupported reducers:\n\t\t  mean\t\tAverage of the region (default)\n\t\t  weighted\tAverage weighted towards saturated pixels\n\t\t  mode\t\tMost common value of each channel; slower the larger the regions are\n\n");
+
+    printf("\t--smooth\t-t\t\tHow sampled colors are smoothed over time. Can't be changed while running.\n");
+    printf("\t\tSupported smoothing modes:\n\t\t  n\tnone\n\t\t  e\texp\t\tExponential (default)\n\t\t  a\tadaptive\tExponential that follows large changes faster than small ones\n\t\t  c\tcut\t\tExponential that jumps straight to a new scene\n\n");
+
+    printf("\t--smooth-time\t-T\t\tTime constant of the smoothing in milliseconds (default %d). The lights look the same\n\t\tat any --fps. Can't be changed while running.\n\n", DEFAULT_SMOOTH_TIME);
+
+    printf("\t--downscale\t-D\t\tHave the X server shrink the captured screen by this factor (2-16) with XRender before\n\t\tfetching it. Each pixel fetched is the average of a block of the screen, which costs a little\n\t\tcolor precision for much less copying on large displays. Can't be changed while running.\n\n");
+
+    printf("\t--budget\t-B\t\tMilliseconds each screen capture may take. When a busy machine pushes captures over it,\n\t\tfewer rows are sampled, the screen is shrunk further (needs XRender) and finally fewer frames are\n\t\tcaptured, and all of that is undone once there's time to spare again. Also captures fewer frames\n\t\twhile nothing on the screen changes. Off by default. Can't be changed while running.\n\n");
+
+    printf("\t--threads\t-j\t\tThreads to reduce sampled frames on (1-16, default the number of cores up to 4).\n\t\tCan't be changed while running.\n\n");
+
+    printf("\t--compress\t-z\t\tSend run-length encoded (\"Adr\") frames whenever they are smaller than plain ones.\n\t\tThe device must understand them, as the coupled sketch does.\n\n");
+
+    printf("\t--skip\t\t-k\t\tDon't send frames in which no color changed by more than this (0-255) since the last frame\n\t\tsent (default 0: only identical frames). The last frame is still resent well before the device's\n\t\t15 second timeout blanks the LEDs. -1 sends every frame.\n\n");
+
+    printf("\t--stats\t\t-S\t\tPrint the p50/p95/p99/max latency of each stage (capture, reduce, blend, and serialize,\n\t\tdrain and write per device) over the last 10 seconds, once per second.\n\n");
+
+    printf("\t--socket\t-u\t\tServe frame, byte and write stall counters, capture time and the active settings\n\t\ton a Unix socket at this path in the Prometheus text format. Can't be changed while running.\n\n");
+
+    printf("\t--no-fork\t-F\t\tDon't fork on start. Can't be changed while running.\n");
+    printf("\t--verbose\t-v\t\tIncrease verbosity. Can be specified multiple times. Can't be changed while running.\n");
+    printf("\t\tSingle verbose will show \"frame rate\" and bytes/sec (and X requests per frame\n\t\twhen sampling) along with how busy each pipeline stage is, per device. Double verbose also\n\t\tshows message queue info. Triple verbose will show all info\n\t\t\
 being sent to the device. This is useful for visualizing how the options\n\t\tabove affect what data is sent to the device.\n\n");
 
     printf("\t--version\t-V\t\tDisplay version and exit\n");
     printf("\t--help\t\t-h\t\tDisplay this message and exit\n\n");
     
     printf("\tDevice is the path to the block device to write data to. If not specified,\n\tdefaults to \"%s\"\n\n", DEFAULT_DEVICE);
+    printf("\tMultiple devices may be given to drive several controllers at once. Each one gets\n\tthe next segment of the strip in the order given, either \"leds\" long or an even\n\tshare of the LEDs not claimed by another device. If every device has a count,\n\t--leds is their sum. A slow device never holds up the others.\n\n");
 
     printf("\tOptions are parsed from left to right. For example, specifying --solid and then\n\t--shadow will NOT result in a solid color.\
             \n\n\tIf all this seems confusing, just play with the options and try triple verbose.\n");
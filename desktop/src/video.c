@@ -0,0 +1,438 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * The video frame source, which reads the frames to sample from a file, a pipe or
+ * stdin instead of grabbing them off the screen. This suits boxes where a decoder
+ * already has the frames, e.g.
+ *
+ *   ffmpeg -i movie.mkv -f yuv4mpegpipe - | colorswirl -m -i -
+ *
+ * Two formats are read:
+ *
+ *   - YUV4MPEG2 (Y4M), the default. The header gives the size, frame rate and chroma
+ *     subsampling (420, 422, 444 or mono, 8 bits). Frames are converted with BT.601
+ *     and limited range unless the header says XCOLORRANGE=FULL.
+ *   - Raw packed RGB, 3 bytes per pixel, given as "rgb:WIDTHxHEIGHT[@FPS]:PATH" since
+ *     the stream itself says nothing about its size.
+ *
+ * Frames are taken at the stream's rate: each capture reads up to the frame that's due
+ * by then, reading and dropping the ones in between so the LEDs don't fall behind.
+ * When no new frame is due nothing counts as damaged and the frame costs nothing. A
+ * raw stream without a rate takes one frame per capture, which lets the writer set the
+ * pace. The stream ending stops colorswirl like a SIGTERM.
+ *
+ * Only the capture strips are converted, into the same 32 bit images the X11 source
+ * produces, and shrinking them for --downscale averages the source pixels here.
+ *
+ */
+
+#include "colorswirl.h"
+#include "capture.h"
+#include "pipeline.h"
+#include "source.h"
+
+#define Y4M_MAGIC        "YUV4MPEG2 "
+#define Y4M_FRAME_MAGIC  "FRAME"
+#define RAW_PREFIX       "rgb:"
+
+static FILE *input;
+static const char *inputPath;
+static int isY4m;               // Flag for the stream being Y4M; raw RGB otherwise
+static int chromaShiftX;        // log2 of the chroma subsampling in each direction
+static int chromaShiftY;
+static int hasChroma;           // Flag for the stream having color at all
+static int isFullRange;         // Flag for luma running from 0 to 255 rather than 16 to 235
+static double frameRate;        // Frames per second of the stream; 0 for one frame per capture
+static unsigned char *frame;    // The frame being shown; packed RGB or the Y, Cb and Cr planes one after another
+static size_t frameSize;
+static size_t lumaSize;
+static size_t chromaSize;
+static int chromaWidth;
+static uint64_t startTime;      // When the first frame was read
+static uint64_t numFramesRead;
+static int isEnded;             // Flag for the stream having run out
+static XRectangle outputs[1];   // The whole frame
+
+static void openVideo();
+static void readY4mHeader();
+static int readFrame();
+static void endOfInput();
+static const XRectangle* getOutputs(int *numOutputs);
+static int haveOutputsChanged();
+static void createStrip(CaptureStrip *strip);
+static void destroyStrip(CaptureStrip *strip);
+static int setScale(int scale);
+static int canScale();
+static int fetchDamage(XRectangle **rects, int *numRects);
+static void captureStrip(CaptureStrip *strip);
+static unsigned long getRequests();
+static uint32_t getRgbPixel(int red, int green, int blue);
+static uint32_t getYuvPixel(int luma, int cb, int cr);
+
+const FrameSource videoSource = {
+    .name             = "video",
+    .open             = openVideo,
+    .getOutputs       = getOutputs,
+    .hasScreenChanged = haveOutputsChanged,
+    .createStrip      = createStrip,
+    .destroyStrip     = destroyStrip,
+    .setScale         = setScale,
+    .canScale         = canScale,
+    .fetchDamage      = fetchDamage,
+    .captureStrip     = captureStrip,
+    .getRequests      = getRequests
+};
+
+
+static void openVideo() {
+    int numChars = 0;
+
+    if(outputNames != NULL) {
+        fprintf(stderr, "%s: --output only applies to capturing the screen.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    // Raw streams carry their size in the spec; anything else is a path to a Y4M stream
+    if(strncmp(inputSpec, RAW_PREFIX, strlen(RAW_PREFIX)) == 0) {
+        const char *spec = inputSpec + strlen(RAW_PREFIX);
+
+        if(sscanf(spec, "%dx%d%n", &screenWidth, &screenHeight, &numChars) != 2 || screenWidth < 1 || screenHeight < 1) {
+            fprintf(stderr, "%s: Expected \"rgb:WIDTHxHEIGHT[@FPS]:PATH\" for a raw input.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+        spec += numChars;
+
+        if(*spec == '@' && (sscanf(spec, "@%lf%n", &frameRate, &numChars) != 1 || frameRate <= 0)) {
+            fprintf(stderr, "%s: Expected \"rgb:WIDTHxHEIGHT[@FPS]:PATH\" for a raw input.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+        spec += (*spec == '@') ? numChars : 0;
+
+        if(*spec != ':' || spec[1] == '\0') {
+            fprintf(stderr, "%s: Expected \"rgb:WIDTHxHEIGHT[@FPS]:PATH\" for a raw input.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+        inputPath = spec + 1;
+    } else {
+        inputPath = inputSpec;
+        isY4m = TRUE;
+    }
+
+    if(strcmp(inputPath, "-") == 0) {
+        input = stdin;
+    } else if((input = fopen(inputPath, "rb")) == NULL) {
+        fprintf(stderr, "%s: Error opening input \"%s\": %s\n", prog, inputPath, strerror(errno));
+        exit(ABNORMAL_EXIT);
+    }
+
+    if(isY4m) {
+        readY4mHeader();
+    } else {
+        lumaSize = (size_t)screenWidth * screenHeight * 3;
+    }
+
+    frameSize = lumaSize + 2 * chromaSize;
+    if((frame = malloc(frameSize)) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    outputs[0] = (XRectangle){.x = 0, .y = 0, .width = screenWidth, .height = screenHeight};
+
+    if(verbose >= VERBOSE) {
+        printf("%s: Reading %s frames from %s at %s\n", prog, isY4m ? "Y4M" : "raw RGB", (input == stdin) ? "stdin" : inputPath,
+            (frameRate > 0) ? "the stream's rate" : "the capture rate");
+    }
+}
+
+
+static void readY4mHeader() {
+    char *header = NULL;
+    size_t headerLen = 0;
+    char *savePtr;
+    int rateNum = 0;
+    int rateDen = 1;
+
+    if(getline(&header, &headerLen, input) == -1 || strncmp(header, Y4M_MAGIC, strlen(Y4M_MAGIC)) != 0) {
+        fprintf(stderr, "%s: Input \"%s\" isn't a YUV4MPEG2 stream. Raw RGB needs \"rgb:WIDTHxHEIGHT[@FPS]:PATH\".\n", prog, inputPath);
+        exit(ABNORMAL_EXIT);
+    }
+
+    screenWidth = 0;
+    screenHeight = 0;
+    chromaShiftX = 1;
+    chromaShiftY = 1;
+    hasChroma = TRUE;
+
+    // Tagged fields separated by spaces; the ones that don't change how pixels are read are skipped
+    for(char *field=strtok_r(header + strlen(Y4M_MAGIC), " \n", &savePtr); field != NULL; field=strtok_r(NULL, " \n", &savePtr)) {
+        switch(field[0]) {
+            case 'W':
+                screenWidth = atoi(field + 1);
+                break;
+            case 'H':
+                screenHeight = atoi(field + 1);
+                break;
+            case 'F':
+                if(sscanf(field + 1, "%d:%d", &rateNum, &rateDen) != 2 || rateDen <= 0) {
+                    rateNum = 0;
+                }
+                break;
+            case 'C':
+                if(strncmp(field + 1, "420", 3) == 0 && (field[4] == '\0' || strcmp(field + 4, "jpeg") == 0 || strcmp(field + 4, "paldv") == 0 || strcmp(field + 4, "mpeg2") == 0)) {
+                    chromaShiftX = chromaShiftY = 1;
+                } else if(strcmp(field + 1, "422") == 0) {
+                    chromaShiftX = 1;
+                    chromaShiftY = 0;
+                } else if(strcmp(field + 1, "444") == 0) {
+                    chromaShiftX = chromaShiftY = 0;
+                } else if(strcmp(field + 1, "mono") == 0) {
+                    hasChroma = FALSE;
+                } else {
+                    fprintf(stderr, "%s: Y4M colorspace \"%s\" isn't supported. Use 420, 422, 444 or mono with 8 bits.\n", prog, field + 1);
+                    exit(ABNORMAL_EXIT);
+                }
+                break;
+            case 'X':
+                isFullRange |= (strcmp(field + 1, "COLORRANGE=FULL") == 0);
+                break;
+        }
+    }
+
+    free(header);
+
+    if(screenWidth < 1 || screenHeight < 1) {
+        fprintf(stderr, "%s: Input \"%s\" doesn't give the frame size.\n", prog, inputPath);
+        exit(ABNORMAL_EXIT);
+    }
+
+    frameRate = (rateNum > 0) ? (double)rateNum / rateDen : 0;
+    lumaSize = (size_t)screenWidth * screenHeight;
+
+    if(hasChroma) {
+        chromaWidth = (screenWidth + (1 << chromaShiftX) - 1) >> chromaShiftX;
+        chromaSize = (size_t)chromaWidth * ((screenHeight + (1 << chromaShiftY) - 1) >> chromaShiftY);
+    }
+}
+
+
+static int readFrame() {
+    // Y4M frames each start with a line of their own, which may carry parameters nothing here needs
+    if(isY4m) {
+        char magic[sizeof(Y4M_FRAME_MAGIC)];
+        int c;
+
+        if(fread(magic, 1, strlen(Y4M_FRAME_MAGIC), input) != strlen(Y4M_FRAME_MAGIC)) {
+            return FALSE;
+        }
+
+        if(memcmp(magic, Y4M_FRAME_MAGIC, strlen(Y4M_FRAME_MAGIC)) != 0) {
+            fprintf(stderr, "%s: Input \"%s\" lost sync with its Y4M frames.\n", prog, inputPath);
+            return FALSE;
+        }
+
+        while((c = fgetc(input)) != '\n') {
+            if(c == EOF) {
+                return FALSE;
+            }
+        }
+    }
+
+    return fread(frame, 1, frameSize, input) == frameSize;
+}
+
+
+static void endOfInput() {
+    if(verbose >= VERBOSE) {
+        printf("%s: End of input after %lu frames\n", prog, (unsigned long)numFramesRead);
+    }
+
+    // Leave the way a SIGTERM would; the capture thread keeps showing the last frame until then
+    isEnded = TRUE;
+    kill(getpid(), SIGTERM);
+}
+
+
+static const XRectangle* getOutputs(int *numOutputs) {
+    *numOutputs = 1;
+    return outputs;
+}
+
+
+static int haveOutputsChanged() {
+    return FALSE;
+}
+
+
+static void createStrip(CaptureStrip *strip) {
+    static const int hostByteOrder = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ? LSBFirst : MSBFirst;
+    XImage *image;
+
+    // Laid out the way a 24 bit TrueColor server would hand them out so the reducers take the direct path
+    if((image = calloc(1, sizeof(XImage))) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    image->width            = getScaledSize(strip->width, strip->scale);
+    image->height           = getScaledSize(strip->height, strip->scale);
+    image->format           = ZPixmap;
+    image->byte_order       = hostByteOrder;
+    image->bitmap_unit      = 32;
+    image->bitmap_bit_order = hostByteOrder;
+    image->bitmap_pad       = 32;
+    image->depth            = 24;
+    image->bytes_per_line   = image->width * sizeof(uint32_t);
+    image->bits_per_pixel   = 32;
+    image->red_mask         = 0xff0000;
+    image->green_mask       = 0xff00;
+    image->blue_mask        = 0xff;
+
+    if((image->data = calloc(image->height, image->bytes_per_line)) == NULL || !XInitImage(image)) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    strip->isShm = FALSE;
+    strip->image = image;
+}
+
+
+static void destroyStrip(CaptureStrip *strip) {
+    XDestroyImage(strip->image);
+    strip->image = NULL;
+}
+
+
+static int setScale(int scale) {
+    // Shrinking is done while converting so any scale works
+    (void)scale;
+    return TRUE;
+}
+
+
+static int canScale() {
+    return TRUE;
+}
+
+
+static int fetchDamage(XRectangle **rects, int *numRects) {
+    uint64_t now = getMonotonicTime();
+    uint64_t numDue = numFramesRead + 1;
+
+    *rects = NULL;
+    *numRects = 0;
+
+    if(isEnded) {
+        return FALSE;
+    }
+
+    if(frameRate > 0 && numFramesRead > 0) {
+        numDue = (uint64_t)((now - startTime) / 1e9 * frameRate) + 1;
+    }
+
+    // The frame read last is still the one showing
+    if(numFramesRead >= numDue) {
+        return !useDamage;
+    }
+
+    // Frames that went by since the last capture are read and dropped
+    while(numFramesRead < numDue) {
+        if(!readFrame()) {
+            endOfInput();
+            return FALSE;
+        }
+
+        if(numFramesRead++ == 0) {
+            startTime = now;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static void captureStrip(CaptureStrip *strip) {
+    XImage *image = strip->image;
+    int scale = strip->scale;
+    const unsigned char *luma = frame;
+    const unsigned char *cb = frame + lumaSize;
+    const unsigned char *cr = cb + chromaSize;
+
+    // Each pixel of the image is the mean of the scale x scale block of the frame it covers
+    for(int y=0; y<image->height; y++) {
+        uint32_t *row = (uint32_t*)(image->data + (size_t)y * image->bytes_per_line);
+        int top = strip->y + y * scale;
+        int bottom = (top + scale < strip->y + strip->height) ? top + scale : strip->y + strip->height;
+
+        for(int x=0; x<image->width; x++) {
+            int left = strip->x + x * scale;
+            int right = (left + scale < strip->x + strip->width) ? left + scale : strip->x + strip->width;
+            int count = (right - left) * (bottom - top);
+            int sums[3] = {0, 0, 0};
+
+            for(int j=top; j<bottom; j++) {
+                for(int i=left; i<right; i++) {
+                    if(!isY4m) {
+                        const unsigned char *pixel = frame + ((size_t)j * screenWidth + i) * 3;
+                        sums[0] += pixel[0];
+                        sums[1] += pixel[1];
+                        sums[2] += pixel[2];
+                    } else if(hasChroma) {
+                        size_t chroma = (size_t)(j >> chromaShiftY) * chromaWidth + (i >> chromaShiftX);
+                        sums[0] += luma[(size_t)j * screenWidth + i];
+                        sums[1] += cb[chroma];
+                        sums[2] += cr[chroma];
+                    } else {
+                        sums[0] += luma[(size_t)j * screenWidth + i];
+                        sums[1] += 128;
+                        sums[2] += 128;
+                    }
+                }
+            }
+
+            int means[3] = {
+                (sums[0] + count / 2) / count,
+                (sums[1] + count / 2) / count,
+                (sums[2] + count / 2) / count
+            };
+            row[x] = isY4m ? getYuvPixel(means[0], means[1], means[2]) : getRgbPixel(means[0], means[1], means[2]);
+        }
+    }
+}
+
+
+static unsigned long getRequests() {
+    // Nothing is asked of a server; reading ahead in the stream is what a capture costs
+    return 0;
+}
+
+
+static uint32_t getRgbPixel(int red, int green, int blue) {
+    red   = (red < 0)   ? 0 : (red > 255)   ? 255 : red;
+    green = (green < 0) ? 0 : (green > 255) ? 255 : green;
+    blue  = (blue < 0)  ? 0 : (blue > 255)  ? 255 : blue;
+
+    return (red << 16) | (green << 8) | blue;
+}
+
+
+static uint32_t getYuvPixel(int luma, int cb, int cr) {
+    // BT.601 in 8.8 fixed point
+    int u = cb - 128;
+    int v = cr - 128;
+
+    if(isFullRange) {
+        int y = luma * 256;
+        return getRgbPixel((y + 359 * v + 128) >> 8, (y - 88 * u - 183 * v + 128) >> 8, (y + 454 * u + 128) >> 8);
+    }
+
+    int y = (luma - 16) * 298;
+    return getRgbPixel((y + 409 * v + 128) >> 8, (y - 100 * u - 208 * v + 128) >> 8, (y + 516 * u + 128) >> 8);
+}
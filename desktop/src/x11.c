@@ -0,0 +1,567 @@
+/*
+ *
+ * Colorswirl
+ *
+ * Author: Shane Tully
+ *
+ * Source:      https://github.com/shanet/Adalight
+ * Forked from: https://github.com/adafruit/Adalight
+ *
+ * The X11 frame source, which grabs the capture strips off the root window.
+ *
+ * When the X server supports the MIT-SHM extension, one shared memory segment the
+ * size of the root window is attached at startup and the strips are written straight
+ * into it by the server. Otherwise each strip falls back to XGetSubImage(), which
+ * copies the pixels through the X socket into an image allocated once per strip.
+ *
+ * With --downscale the X server first shrinks each strip with XRender: the root window
+ * is composited through a scaling transform and a box filter into a small pixmap per
+ * strip, and only that pixmap is fetched. Every fetched pixel is then the average of a
+ * scale x scale block of the screen, so the transfer and the reduction both shrink by
+ * the square of the scale. The quality controller can change the scale while running, in
+ * which case every strip is set up again at the new size.
+ *
+ * When built with libXdamage, the X server is asked to report which parts of the root
+ * window were drawn to. Each frame the damage accumulated since the last one is fetched
+ * as a list of rectangles; strips that don't touch any of them are not captured again and
+ * the sampler only reduces the regions that do. If nothing at all was damaged no damage
+ * event is queued and the frame makes no X requests.
+ *
+ * When built with libXrandr, --output limits sampling to the monitors the LEDs are on:
+ * the layout is placed around the CRTC rectangles of the named outputs and only those
+ * rectangles are captured. The X server reports when the monitors are rearranged or
+ * change mode, and the sampler then finds the outputs again and lays the regions out
+ * over their new rectangles without restarting.
+ *
+ */
+
+#include "colorswirl.h"
+#include "capture.h"
+#include "source.h"
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+
+static Damage damage;                 // Damage accumulated on the root window since the last frame
+static XserverRegion damagedRegion;   // Where the damage is moved to so it can be fetched
+static int damageEventBase;
+#endif
+
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+
+static int randrEventBase;
+static int hasRandr;                  // Flag for the X server reporting changes to the monitors
+#endif
+
+static XShmSegmentInfo shmInfo; // The shared segment captures are written into
+static size_t shmSize;          // Size of the shared segment in bytes
+static size_t shmUsed;          // Bytes of the shared segment handed out to capture strips
+static int numShmStrips;        // Strips with an image in the shared segment
+static int isShmAttached;       // Flag for the shared segment being attached to the X server
+static int shmAttachFailed;     // Set by the error handler if the X server refuses the segment
+
+static Picture rootPicture;             // The root window as seen through the scaling transform
+static XRectangle *damagedRects;        // Parts of the screen drawn to since the previous frame
+static XRectangle outputs[MAX_OUTPUTS]; // Parts of the root window that are sampled
+static int numOutputs;
+
+static void openXDisplay();
+static void getScreenResolution();
+static const XRectangle* getOutputs(int *numOutputs);
+static int haveOutputsChanged();
+static void createStrip(CaptureStrip *strip);
+static void destroyStrip(CaptureStrip *strip);
+static int setScale(int scale);
+static int canScale();
+static int fetchDamage(XRectangle **rects, int *numRects);
+static void captureStrip(CaptureStrip *strip);
+static unsigned long getRequests();
+
+static void createRootPicture();
+static void setRootPictureScale(int scale);
+static void createDamage();
+static void selectScreenChanges();
+static int findOutputs(int isStartup);
+
+static void attachShmSegment();
+static XImage* createStripImage(CaptureStrip *strip, int isShmAllowed);
+static int shmErrorHandler(Display *display, XErrorEvent *event);
+
+const FrameSource x11Source = {
+    .name             = "X11",
+    .open             = openXDisplay,
+    .getOutputs       = getOutputs,
+    .hasScreenChanged = haveOutputsChanged,
+    .createStrip      = createStrip,
+    .destroyStrip     = destroyStrip,
+    .setScale         = setScale,
+    .canScale         = canScale,
+    .fetchDamage      = fetchDamage,
+    .captureStrip     = captureStrip,
+    .getRequests      = getRequests
+};
+
+
+static void openXDisplay() {
+    if(XDisplay == NULL) {
+        XDisplay = XOpenDisplay(NULL);
+
+        if(XDisplay == NULL) {
+            fprintf(stderr, "%s: Could not open X display.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+
+        if(useShm) {
+            attachShmSegment();
+        }
+
+        // The quality controller may start shrinking captures later on
+        if(captureScale > 1 || frameBudget > 0) {
+            createRootPicture();
+        }
+
+        if(useDamage) {
+            createDamage();
+        }
+
+        selectScreenChanges();
+        getScreenResolution();
+    }
+}
+
+
+static void selectScreenChanges() {
+#ifdef HAVE_XRANDR
+    int errorBase;
+    int major;
+    int minor;
+
+    // Getting the current configuration without probing the monitors needs RandR 1.3
+    if(!XRRQueryExtension(XDisplay, &randrEventBase, &errorBase) || !XRRQueryVersion(XDisplay, &major, &minor) || major * 100 + minor < 103) {
+        if(outputNames != NULL) {
+            fprintf(stderr, "%s: XRandR 1.3 extension not available. Can't find the outputs to sample.\n", prog);
+            exit(ABNORMAL_EXIT);
+        }
+        return;
+    }
+
+    XRRSelectInput(XDisplay, DefaultRootWindow(XDisplay), RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+    hasRandr = TRUE;
+#else
+    if(outputNames != NULL) {
+        fprintf(stderr, "%s: Built without XRandR. Can't find the outputs to sample.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+#endif
+}
+
+
+static void createDamage() {
+#ifdef HAVE_XDAMAGE
+    int errorBase;
+
+    if(!XDamageQueryExtension(XDisplay, &damageEventBase, &errorBase)) {
+        fprintf(stderr, "%s: XDamage extension not available. Capturing every frame in full.\n", prog);
+        useDamage = 0;
+        return;
+    }
+
+    // One event when the damage goes from empty to not empty is all that's needed; the rectangles are fetched per frame
+    damage = XDamageCreate(XDisplay, DefaultRootWindow(XDisplay), XDamageReportNonEmpty);
+    damagedRegion = XFixesCreateRegion(XDisplay, NULL, 0);
+
+    if(verbose >= VERBOSE) {
+        printf("%s: Tracking screen damage through XDamage\n", prog);
+    }
+#else
+    if(verbose >= VERBOSE) {
+        printf("%s: Built without XDamage. Capturing every frame in full.\n", prog);
+    }
+    useDamage = 0;
+#endif
+}
+
+
+static int fetchDamage(XRectangle **rects, int *numRects) {
+    if(damagedRects != NULL) {
+        XFree(damagedRects);
+        damagedRects = NULL;
+    }
+    *rects = NULL;
+    *numRects = 0;
+
+    // Every frame without damage tracking is captured in full
+    if(!useDamage) {
+        return TRUE;
+    }
+
+#ifdef HAVE_XDAMAGE
+    XEvent event;
+    int isDamaged = FALSE;
+
+    // Reads whatever arrived on the socket without blocking; an event still in flight is picked up next frame
+    while(XCheckTypedEvent(XDisplay, damageEventBase + XDamageNotify, &event)) {
+        isDamaged = TRUE;
+    }
+
+    if(isDamaged) {
+        XDamageSubtract(XDisplay, damage, None, damagedRegion);
+        damagedRects = XFixesFetchRegion(XDisplay, damagedRegion, numRects);
+        *rects = damagedRects;
+    }
+#endif
+
+    return FALSE;
+}
+
+
+static void createRootPicture() {
+    int eventBase;
+    int errorBase;
+    Window root = DefaultRootWindow(XDisplay);
+    XRenderPictFormat *format = XRenderFindVisualFormat(XDisplay, DefaultVisual(XDisplay, DefaultScreen(XDisplay)));
+
+    if(!XRenderQueryExtension(XDisplay, &eventBase, &errorBase) || format == NULL) {
+        fprintf(stderr, "%s: XRender extension not available. Capturing at full resolution.\n", prog);
+        captureScale = 1;
+        return;
+    }
+
+    // Draw the contents of the windows on top of the root too, like XGetImage() does
+    XRenderPictureAttributes attrs = {
+        .subwindow_mode = IncludeInferiors
+    };
+    rootPicture = XRenderCreatePicture(XDisplay, root, format, CPSubwindowMode, &attrs);
+
+    if(captureScale > 1) {
+        setRootPictureScale(captureScale);
+
+        if(verbose >= VERBOSE) {
+            printf("%s: Shrinking captures by %d through XRender\n", prog, captureScale);
+        }
+    }
+}
+
+
+static void setRootPictureScale(int scale) {
+    // Each destination pixel samples the source scale times further along
+    XTransform transform = {{
+        {XDoubleToFixed(scale), 0,                     0},
+        {0,                     XDoubleToFixed(scale), 0},
+        {0,                     0,                     XDoubleToFixed(1)}
+    }};
+    XRenderSetPictureTransform(XDisplay, rootPicture, &transform);
+
+    // and averages the scale x scale block of source pixels around it
+    XFixed kernel[2 + MAX_CAPTURE_SCALE * MAX_CAPTURE_SCALE];
+    kernel[0] = kernel[1] = XDoubleToFixed(scale);
+    for(int i=0; i<scale * scale; i++) {
+        kernel[2 + i] = XDoubleToFixed(1.0 / (scale * scale));
+    }
+    XRenderSetPictureFilter(XDisplay, rootPicture, FilterConvolution, kernel, 2 + scale * scale);
+}
+
+
+static void attachShmSegment() {
+    int screen = DefaultScreen(XDisplay);
+    XWindowAttributes attrs;
+
+    if(!XShmQueryExtension(XDisplay)) {
+        if(verbose >= VERBOSE) {
+            printf("%s: MIT-SHM extension not available. Falling back to XGetImage.\n", prog);
+        }
+        return;
+    }
+
+    // Size the segment from a full root window image so that every strip fits in it
+    XGetWindowAttributes(XDisplay, DefaultRootWindow(XDisplay), &attrs);
+    XImage *rootImage = XShmCreateImage(XDisplay, DefaultVisual(XDisplay, screen), DefaultDepth(XDisplay, screen), ZPixmap, NULL, &shmInfo, attrs.width, attrs.height);
+    if(rootImage == NULL) {
+        return;
+    }
+    shmSize = rootImage->bytes_per_line * rootImage->height;
+    XDestroyImage(rootImage);
+
+    if((shmInfo.shmid = shmget(IPC_PRIVATE, shmSize, IPC_CREAT | 0600)) == -1) {
+        fprintf(stderr, "%s: Failed to create shared memory segment: %s. Falling back to XGetImage.\n", prog, strerror(errno));
+        return;
+    }
+
+    shmInfo.shmaddr = shmat(shmInfo.shmid, NULL, 0);
+    shmInfo.readOnly = False;
+
+    // The server refuses the segment with BadAccess if it is on another machine so catch the error instead of exiting
+    XSync(XDisplay, False);
+    XErrorHandler prevHandler = XSetErrorHandler(shmErrorHandler);
+    shmAttachFailed = FALSE;
+    if(shmInfo.shmaddr != (char*)-1) {
+        XShmAttach(XDisplay, &shmInfo);
+        XSync(XDisplay, False);
+    }
+    XSetErrorHandler(prevHandler);
+
+    // Mark the segment for removal now so it goes away with the process however we exit
+    shmctl(shmInfo.shmid, IPC_RMID, NULL);
+
+    if(shmAttachFailed || shmInfo.shmaddr == (char*)-1) {
+        fprintf(stderr, "%s: Failed to attach shared memory segment. Falling back to XGetImage.\n", prog);
+        if(shmInfo.shmaddr != (char*)-1) {
+            shmdt(shmInfo.shmaddr);
+        }
+        return;
+    }
+
+    isShmAttached = TRUE;
+
+    if(verbose >= VERBOSE) {
+        printf("%s: Capturing through MIT-SHM\n", prog);
+    }
+}
+
+
+static int shmErrorHandler(Display *display, XErrorEvent *event) {
+    // Do something with the arguments to make GCC happy and get rid of the unused parameter warning
+    (void)display;
+    (void)event;
+
+    shmAttachFailed = TRUE;
+    return 0;
+}
+
+
+static void getScreenResolution() {
+    XWindowAttributes attrs;
+    XGetWindowAttributes(XDisplay, DefaultRootWindow(XDisplay), &attrs);
+
+    screenWidth = attrs.width;
+    screenHeight = attrs.height;
+
+    if(findOutputs(TRUE) > 0) {
+        exit(ABNORMAL_EXIT);
+    }
+}
+
+
+static int findOutputs(int isStartup) {
+    // Without --output the whole root window is sampled
+    numOutputs = 0;
+    if(outputNames == NULL) {
+        outputs[numOutputs++] = (XRectangle){.x = 0, .y = 0, .width = screenWidth, .height = screenHeight};
+        return 0;
+    }
+
+    int numMissing = 0;
+
+#ifdef HAVE_XRANDR
+    char names[MAX_MSG_LEN];
+    char *savePtr;
+    XRRScreenResources *resources = XRRGetScreenResourcesCurrent(XDisplay, DefaultRootWindow(XDisplay));
+
+    snprintf(names, sizeof(names), "%s", outputNames);
+
+    for(char *name=strtok_r(names, ",", &savePtr); name != NULL && numOutputs < MAX_OUTPUTS; name=strtok_r(NULL, ",", &savePtr)) {
+        int isFound = FALSE;
+
+        for(int i=0; i<resources->noutput && !isFound; i++) {
+            XRROutputInfo *output = XRRGetOutputInfo(XDisplay, resources, resources->outputs[i]);
+
+            // A connected output without a CRTC is turned off
+            if(strcmp(output->name, name) == 0 && output->connection == RR_Connected && output->crtc != None) {
+                XRRCrtcInfo *crtc = XRRGetCrtcInfo(XDisplay, resources, output->crtc);
+                outputs[numOutputs++] = (XRectangle){.x = crtc->x, .y = crtc->y, .width = crtc->width, .height = crtc->height};
+                isFound = TRUE;
+
+                if(verbose >= VERBOSE) {
+                    printf("%s: Sampling output %s at %ux%u+%d+%d\n", prog, name, crtc->width, crtc->height, crtc->x, crtc->y);
+                }
+                XRRFreeCrtcInfo(crtc);
+            }
+
+            XRRFreeOutputInfo(output);
+        }
+
+        if(!isFound) {
+            fprintf(stderr, "%s: Output \"%s\" isn't connected or is turned off.%s\n", prog, name, isStartup ? "" : " Sampling the others.");
+            numMissing++;
+        }
+    }
+
+    XRRFreeScreenResources(resources);
+#else
+    (void)isStartup;
+#endif
+
+    return numMissing;
+}
+
+
+static int haveOutputsChanged() {
+#ifdef HAVE_XRANDR
+    XEvent event;
+    int isChanged = FALSE;
+
+    if(!hasRandr) {
+        return FALSE;
+    }
+
+    // Like the damage, only reads what's already arrived so a frame without changes makes no requests
+    while(XCheckTypedEvent(XDisplay, randrEventBase + RRScreenChangeNotify, &event) || XCheckTypedEvent(XDisplay, randrEventBase + RRNotify, &event)) {
+        XRRUpdateConfiguration(&event);
+        isChanged = TRUE;
+    }
+
+    if(!isChanged) {
+        return FALSE;
+    }
+
+    XRectangle prevOutputs[MAX_OUTPUTS];
+    int prevNumOutputs = numOutputs;
+    memcpy(prevOutputs, outputs, sizeof(outputs));
+
+    XWindowAttributes attrs;
+    XGetWindowAttributes(XDisplay, DefaultRootWindow(XDisplay), &attrs);
+    screenWidth = attrs.width;
+    screenHeight = attrs.height;
+    findOutputs(FALSE);
+
+    // Plugging in a monitor the LEDs aren't on changes nothing that's sampled
+    return numOutputs != prevNumOutputs || memcmp(outputs, prevOutputs, numOutputs * sizeof(XRectangle)) != 0;
+#else
+    return FALSE;
+#endif
+}
+
+
+static const XRectangle* getOutputs(int *numScreenOutputs) {
+    *numScreenOutputs = numOutputs;
+    return outputs;
+}
+
+
+static void createStrip(CaptureStrip *strip) {
+    // Scaled strips are rendered into a pixmap of their own which is then fetched like a window
+    if(strip->scale > 1) {
+        int screen = DefaultScreen(XDisplay);
+        XRenderPictFormat *format = XRenderFindVisualFormat(XDisplay, DefaultVisual(XDisplay, screen));
+
+        strip->pixmap = XCreatePixmap(XDisplay, RootWindow(XDisplay, screen), getScaledSize(strip->width, strip->scale), getScaledSize(strip->height, strip->scale), DefaultDepth(XDisplay, screen));
+        strip->picture = XRenderCreatePicture(XDisplay, strip->pixmap, format, 0, NULL);
+    }
+
+    strip->image = createStripImage(strip, TRUE);
+}
+
+
+static void destroyStrip(CaptureStrip *strip) {
+    if(strip->scale > 1) {
+        XRenderFreePicture(XDisplay, strip->picture);
+        XFreePixmap(XDisplay, strip->pixmap);
+    }
+
+    // Shared images only point into the segment so destroying them leaves it alone. Strips are
+    // always destroyed all at once, so once none are left the segment is handed out from the start again.
+    if(strip->isShm && --numShmStrips == 0) {
+        shmUsed = 0;
+    }
+
+    XDestroyImage(strip->image);
+    strip->image = NULL;
+}
+
+
+static int setScale(int scale) {
+    if(scale > 1 && rootPicture == None) {
+        return FALSE;
+    }
+
+    if(scale > 1) {
+        setRootPictureScale(scale);
+    }
+
+    return TRUE;
+}
+
+
+static int canScale() {
+    return rootPicture != None;
+}
+
+
+static XImage* createStripImage(CaptureStrip *strip, int isShmAllowed) {
+    int screen = DefaultScreen(XDisplay);
+    Visual *visual = DefaultVisual(XDisplay, screen);
+    int depth = DefaultDepth(XDisplay, screen);
+    XImage *image;
+    int width = getScaledSize(strip->width, strip->scale);
+    int height = getScaledSize(strip->height, strip->scale);
+
+    // Give the strip the next unused part of the shared segment if there's room left
+    if(isShmAttached && isShmAllowed) {
+        image = XShmCreateImage(XDisplay, visual, depth, ZPixmap, NULL, &shmInfo, width, height);
+
+        if(image != NULL && shmUsed + image->bytes_per_line * image->height <= shmSize) {
+            image->data = shmInfo.shmaddr + shmUsed;
+            shmUsed += image->bytes_per_line * image->height;
+            strip->isShm = TRUE;
+            numShmStrips++;
+            return image;
+        }
+
+        if(image != NULL) {
+            XDestroyImage(image);
+        }
+    }
+
+    image = XCreateImage(XDisplay, visual, depth, ZPixmap, 0, NULL, width, height, 32, 0);
+    if(image == NULL || (image->data = malloc(image->bytes_per_line * image->height)) == NULL) {
+        fprintf(stderr, "%s: Failed to allocate memory.\n", prog);
+        exit(ABNORMAL_EXIT);
+    }
+
+    strip->isShm = FALSE;
+    return image;
+}
+
+
+static void captureStrip(CaptureStrip *strip) {
+    Drawable source = RootWindow(XDisplay, DefaultScreen(XDisplay));
+    int sourceX = strip->x;
+    int sourceY = strip->y;
+
+    // Have the server shrink the strip first and fetch the result instead
+    if(strip->scale > 1) {
+        XRenderComposite(XDisplay, PictOpSrc, rootPicture, None, strip->picture, strip->x / strip->scale, strip->y / strip->scale, 0, 0, 0, 0,
+            strip->image->width, strip->image->height);
+
+        source = strip->pixmap;
+        sourceX = 0;
+        sourceY = 0;
+    }
+
+    if(strip->isShm) {
+        if(XShmGetImage(XDisplay, source, strip->image, sourceX, sourceY, AllPlanes)) {
+            return;
+        }
+
+        // Don't try the shared segment again for this strip; move it to a private image instead. Its part of
+        // the segment can't be handed out again until the strips are set up again, unless it was the last one.
+        XDestroyImage(strip->image);
+        strip->isShm = FALSE;
+        if(--numShmStrips == 0) {
+            shmUsed = 0;
+        }
+        strip->image = createStripImage(strip, FALSE);
+    }
+
+    XGetSubImage(XDisplay, source, sourceX, sourceY, strip->image->width, strip->image->height, AllPlanes, ZPixmap, strip->image, 0, 0);
+}
+
+
+static unsigned long getRequests() {
+    return XNextRequest(XDisplay);
+}